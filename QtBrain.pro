@@ -20,13 +20,33 @@ DEFINES += QT_NO_DEBUG QT_NO_DEBUG_OUTPUT QT_USE_FAST_CONCATENATION
     brainwindow.cpp \
     bfvm.cpp \
     bfcompiler.cpp \
-    bfhighlighter.cpp
+    bfhighlighter.cpp \
+    bfsampler.cpp \
+    bfrunner.cpp \
+    bfchannel.cpp \
+    bflexer.cpp \
+    bfsourcemap.cpp \
+    bfprogramcache.cpp \
+    bfblockdata.cpp \
+    bfbracketmatcher.cpp \
+    bfcodeview.cpp \
+    bfmemorymodel.cpp
 HEADERS += brainwindow.h \
     bfvm.h \
     bihash.h \
     customTransitions.h \
     bfcompiler.h \
-    bfhighlighter.h
+    bfhighlighter.h \
+    bfsampler.h \
+    bfrunner.h \
+    bfchannel.h \
+    bfblockdata.h \
+    bflexer.h \
+    bfsourcemap.h \
+    bfprogramcache.h \
+    bfbracketmatcher.h \
+    bfcodeview.h \
+    bfmemorymodel.h
 FORMS += brainwindow.ui
 
 OTHER_FILES += \
@@ -0,0 +1,88 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfblockdata.h"
+#include "bflexer.h"
+#include <QTextBlock>
+
+namespace QtBrain {
+
+    BfBlockData *BfBlockData::of(QTextBlock block) {
+        BfBlockData *data = static_cast<BfBlockData*>(block.userData());
+        if(data != NULL && data->revision == block.revision())
+            return data;
+
+        if(data == NULL) {
+            data = new BfBlockData();
+            block.setUserData(data);    // the block owns it from now on
+        }
+        data->compile(block.text());
+        data->revision = block.revision();
+        return data;
+    }
+
+    bool BfBlockData::isCompiled(const QTextBlock &block) {
+        const BfBlockData *data = static_cast<BfBlockData*>(block.userData());
+        return data != NULL && data->revision == block.revision();
+    }
+
+    void BfBlockData::store(QTextBlock block, const BfBlockData &compiled) {
+        BfBlockData *data = static_cast<BfBlockData*>(block.userData());
+        if(data == NULL) {
+            data = new BfBlockData();
+            block.setUserData(data);
+        }
+        // what was painted stays, it's only the compiler's half that's new
+        data->revision = block.revision();
+        data->ops = compiled.ops;
+        data->positions = compiled.positions;
+        data->brackets = compiled.brackets;
+        data->pairs = compiled.pairs;
+        data->openJnzs = compiled.openJnzs;
+        data->openJzs = compiled.openJzs;
+    }
+
+    void BfBlockData::compile(const QString &text) {
+        clear();
+
+        // the same as BfCompiler::compileChunk(), except that jumps stay inside the block
+        BfLexer::scan(text.constData(), text.size(), 0, ops, positions);
+        QVector<int> jzs;
+        for(int idx = 0; idx < ops.size(); ++idx) {
+            const BfOpcode op = ops[idx];
+            if(op == JZ) {
+                brackets.append(idx);
+                jzs.append(idx);
+            } else if(op == JNZ) {
+                brackets.append(idx);
+                if(jzs.isEmpty()) {
+                    openJnzs.append(idx);
+                } else {
+                    pairs.append(qMakePair(jzs.last(), idx));
+                    jzs.remove(jzs.size()-1);
+                }
+            }
+        }
+        openJzs = jzs;
+    }
+}
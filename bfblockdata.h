@@ -0,0 +1,103 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFBLOCKDATA_H
+#define BFBLOCKDATA_H
+
+#include "bfvm.h"
+#include <QTextBlockUserData>
+#include <QVector>
+#include <QPair>
+
+class QTextBlock;
+
+namespace QtBrain {
+
+    /**
+      What the compiler knows about one QTextBlock (ie. line) of the source. It is kept in
+      the block itself with QTextBlock::setUserData(), so it moves along with the line
+      when lines above it are edited, and goes away with it.
+
+      Everything in here is relative to the block: positions are counted from the start
+      of the block and jumps use indexes into ops. That way the data stays good until the
+      block's own text changes, which is what revision is for.
+
+      The data is shared by everything that needs to know about the brackets of a line:
+      BfCompiler pieces the program together from it, and BfHighlighter paints the loops
+      with it. Whoever gets to a changed block first compiles it with of(), and the
+      others get the stored result.
+      */
+    class BfBlockData : public QTextBlockUserData
+    {
+    public:
+        BfBlockData() : revision(-1), paintedRevision(-1), paintedDepth(0) {}
+
+        /**
+          Returns the compiled contents of the block, compiling it first if it has changed
+          since it was last compiled. The block owns the data.
+          */
+        static BfBlockData *of(QTextBlock block);
+
+        // returns true if the block's data is up to date, ie. of() wouldn't compile it
+        static bool isCompiled(const QTextBlock &block);
+
+        /**
+          Stores data compiled from the block's current text somewhere else, eg. in
+          another thread, as the block's data.
+          */
+        static void store(QTextBlock block, const BfBlockData &compiled);
+
+        /**
+          Clears the data and compiles text into it. Doesn't touch the block, so this
+          can be run on a copy of the text in any thread.
+          */
+        void compile(const QString &text);
+
+        int                     revision;   // QTextBlock::revision() of the compiled text
+
+        QVector<BfOpcode>       ops;        // the block's bytecode
+        QVector<quint32>        positions;  // where each op is in the block
+        QVector<int>            brackets;   // indexes of the [s and ]s in ops, in order
+
+        QVector<QPair<int,int> > pairs;     // [ and ] matched inside the block
+        QVector<int>            openJnzs;   /* ]s that close a [ from an earlier block, in
+                                               order. These always come before openJzs */
+        QVector<int>            openJzs;    // [s closed by a ] in a later block, in order
+
+        int                     paintedRevision;    // the revision and starting depth
+        int                     paintedDepth;       // of the block's last BfHighlighter paint
+
+        // the bracket balance of the block
+        int balance() const { return openJzs.size() - openJnzs.size(); }
+
+        void clear() {
+            ops.clear();
+            positions.clear();
+            brackets.clear();
+            pairs.clear();
+            openJnzs.clear();
+            openJzs.clear();
+        }
+    };
+}
+#endif // BFBLOCKDATA_H
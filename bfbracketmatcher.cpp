@@ -0,0 +1,222 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfbracketmatcher.h"
+#include <QPlainTextEdit>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QAction>
+#include <QStack>
+#include <QtAlgorithms>
+#include <QDebug>
+
+namespace QtBrain {
+
+    BfBracketMatcher::BfBracketMatcher(QPlainTextEdit *editor) :
+            QObject(editor),
+            m_editor(editor),
+            m_revision(-1)
+    {
+        connect(m_editor, SIGNAL(cursorPositionChanged()), this, SLOT(updateSelections()));
+
+        // the shortcuts only work when the editor has focus
+        QAction *jump = new QAction(tr("Jump to matching bracket"), m_editor);
+        jump->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_BracketRight));
+        jump->setShortcutContext(Qt::WidgetShortcut);
+        connect(jump, SIGNAL(triggered()), this, SLOT(jumpToMatchingBracket()));
+        m_editor->addAction(jump);
+
+        QAction *fold = new QAction(tr("Fold or unfold loop"), m_editor);
+        fold->setShortcut(QKeySequence(Qt::CTRL + Qt::SHIFT + Qt::Key_BracketLeft));
+        fold->setShortcutContext(Qt::WidgetShortcut);
+        connect(fold, SIGNAL(triggered()), this, SLOT(toggleFold()));
+        m_editor->addAction(fold);
+    }
+
+    void BfBracketMatcher::setProgram(const BiHash<IPType,IPType> &jmps,
+                                      const BfSourceMap &mappings) {
+        m_jmps = jmps;
+        m_mappings = mappings;
+        m_revision = m_editor->document()->revision();
+
+        /* the jump table goes through the JZs in order, so the loops come out sorted.
+           The loops that are still open when a JZ comes along are the ones around it */
+        m_loopJzs.clear();
+        m_loopJnzs.clear();
+        m_parents.clear();
+        m_loopJzs.reserve(m_jmps.size());
+        m_loopJnzs.reserve(m_jmps.size());
+        m_parents.reserve(m_jmps.size());
+        QStack<int> open;
+        for(BiHash<IPType,IPType>::const_iterator it = m_jmps.constBegin();
+            it != m_jmps.constEnd(); ++it) {
+            while(!open.isEmpty() && m_loopJnzs[open.top()] < it.key())
+                open.pop();
+            m_parents.append(open.isEmpty() ? -1 : open.top());
+            open.push(m_loopJzs.size());
+            m_loopJzs.append(it.key());
+            m_loopJnzs.append(it.value());
+        }
+        qDebug("BfBracketMatcher::setProgram() %d loops", m_loopJzs.size());
+
+        updateSelections();
+    }
+
+    void BfBracketMatcher::clear() {
+        m_jmps.clear();
+        m_mappings.clear();
+        m_loopJzs.clear();
+        m_loopJnzs.clear();
+        m_parents.clear();
+        m_revision = -1;
+        updateSelections();
+    }
+
+    bool BfBracketMatcher::isCurrent() const {
+        return m_revision == m_editor->document()->revision();
+    }
+
+    bool BfBracketMatcher::instructionAt(int position, IPType *ip) const {
+        if(position < 0)
+            return false;
+        *ip = m_mappings.key(quint32(position));
+        return m_mappings.containsKey(*ip) && m_mappings.value(*ip) == quint32(position);
+    }
+
+    int BfBracketMatcher::matchingBracket(int position) const {
+        IPType ip;
+        if(!isCurrent() || !instructionAt(position, &ip))
+            return -1;
+        if(m_jmps.containsKey(ip))
+            return int(m_mappings.value(m_jmps.value(ip)));
+        if(m_jmps.containsValue(ip))
+            return int(m_mappings.value(m_jmps.key(ip)));
+        return -1;
+    }
+
+    bool BfBracketMatcher::enclosingLoop(int position, int *open, int *close) const {
+        if(!isCurrent() || position < 0)
+            return false;
+
+        /* the loop has to start before the first instruction at or after the position,
+           and end at it or later. That's either the last loop that starts before it or
+           one of the loops around that one */
+        const IPType ip = m_mappings.key(quint32(position));
+        int loop = qLowerBound(m_loopJzs.begin(), m_loopJzs.end(), ip)
+                   - m_loopJzs.begin() - 1;
+        while(loop >= 0 && m_loopJnzs[loop] < ip)
+            loop = m_parents[loop];
+        if(loop < 0)
+            return false;
+
+        *open = int(m_mappings.value(m_loopJzs[loop]));
+        *close = int(m_mappings.value(m_loopJnzs[loop]));
+        return true;
+    }
+
+    int BfBracketMatcher::bracketAtCursor(int *match) const {
+        // the bracket after the cursor wins, like in most editors
+        const int position = m_editor->textCursor().selectionStart();
+        *match = matchingBracket(position);
+        if(*match >= 0)
+            return position;
+        *match = matchingBracket(position - 1);
+        return *match >= 0 ? position - 1 : -1;
+    }
+
+    void BfBracketMatcher::jumpToMatchingBracket() {
+        int match;
+        if(bracketAtCursor(&match) < 0)
+            return;
+        QTextCursor tc = m_editor->textCursor();
+        tc.setPosition(match);
+        m_editor->setTextCursor(tc);
+    }
+
+    void BfBracketMatcher::toggleFold() {
+        int open, close, match;
+        const int bracket = bracketAtCursor(&match);
+        if(bracket >= 0) {
+            open = qMin(bracket, match);
+            close = qMax(bracket, match);
+        } else if(!enclosingLoop(m_editor->textCursor().selectionStart(), &open, &close)) {
+            return;
+        }
+
+        // folding works on whole lines, so the [ line stays and the rest of the loop goes
+        QTextDocument *doc = m_editor->document();
+        const QTextBlock first = doc->findBlock(open).next();
+        const QTextBlock last = doc->findBlock(close);
+        if(!first.isValid() || first.blockNumber() > last.blockNumber())
+            return;     // all on one line
+
+        const bool fold = first.isVisible();
+        for(QTextBlock block = first; block.isValid(); block = block.next()) {
+            block.setVisible(!fold);
+            if(block == last)
+                break;
+        }
+        doc->markContentsDirty(first.position(), last.position() + last.length()
+                               - first.position());
+
+        // the cursor mustn't be left on a hidden line
+        if(fold) {
+            QTextCursor tc = m_editor->textCursor();
+            tc.setPosition(open);
+            m_editor->setTextCursor(tc);
+        }
+        m_editor->viewport()->update();
+    }
+
+    void BfBracketMatcher::updateSelections() {
+        QList<QTextEdit::ExtraSelection> selections;
+
+        int open, close;
+        if(enclosingLoop(m_editor->textCursor().selectionStart(), &open, &close)) {
+            QTextEdit::ExtraSelection loop;
+            loop.cursor = QTextCursor(m_editor->document());
+            loop.cursor.setPosition(open);
+            loop.cursor.setPosition(close + 1, QTextCursor::KeepAnchor);
+            loop.format.setUnderlineStyle(QTextCharFormat::DotLine);
+            loop.format.setUnderlineColor(Qt::darkGray);
+            selections.append(loop);
+        }
+
+        int match;
+        const int bracket = bracketAtCursor(&match);
+        if(bracket >= 0) {
+            const int ends[2] = {bracket, match};
+            for(int i = 0; i < 2; ++i) {
+                QTextEdit::ExtraSelection end;
+                end.cursor = QTextCursor(m_editor->document());
+                end.cursor.setPosition(ends[i]);
+                end.cursor.setPosition(ends[i] + 1, QTextCursor::KeepAnchor);
+                end.format.setBackground(Qt::yellow);
+                end.format.setFontWeight(QFont::Bold);
+                selections.append(end);
+            }
+        }
+
+        m_editor->setExtraSelections(selections);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFBRACKETMATCHER_H
+#define BFBRACKETMATCHER_H
+
+#include "bfvm.h"
+#include "bihash.h"
+#include "bfsourcemap.h"
+#include <QObject>
+#include <QVector>
+
+class QPlainTextEdit;
+
+namespace QtBrain {
+
+    /**
+      Bracket matching, loop highlighting and loop folding for an editor.
+
+      Nothing here looks at the text: the loops come from the compiler's jump table and
+      are found in the text through the source map, so finding the other end of a loop
+      is a couple of lookups no matter how much is in between. The loop around a position
+      is found with a binary search and a walk up the loops that enclose it.
+
+      The program has to be compiled from exactly what the editor shows, so it's only
+      used while the document is at the revision it was given at. The compiler keeps it
+      fresh by compiling in the background while the user edits (see
+      BfCompiler::prepared()), and in between everything just stays off.
+      */
+    class BfBracketMatcher : public QObject
+    {
+        Q_OBJECT
+    public:
+        BfBracketMatcher(QPlainTextEdit *editor);
+
+        /* the position of the bracket that matches the one at position, or -1 if there's
+           no bracket there or the program isn't up to date */
+        int matchingBracket(int position) const;
+
+        /* finds the innermost loop around position, and returns the positions of its [
+           and ] in open and close. Returns false if there is none */
+        bool enclosingLoop(int position, int *open, int *close) const;
+
+    public slots:
+        /* takes the program compiled from what the editor has in it right now. The jump
+           table and source map are implicitly shared, so this doesn't copy them */
+        void setProgram(const BiHash<IPType,IPType> &jmps, const BfSourceMap &mappings);
+        void clear();                   // forgets the program
+
+        void jumpToMatchingBracket();   // moves the cursor to the other end of its loop
+        void toggleFold();              /* hides the lines of the loop at or around the
+                                           cursor, or shows them if they're hidden */
+
+    protected slots:
+        void updateSelections();        // highlights the loop around the cursor
+
+    protected:
+        QPlainTextEdit          *m_editor;
+        BiHash<IPType,IPType>   m_jmps;
+        BfSourceMap             m_mappings;
+        QVector<IPType>         m_loopJzs;  // the JZ of each loop, in order
+        QVector<IPType>         m_loopJnzs; // ...its JNZ
+        QVector<int>            m_parents;  /* the index of the loop around each loop, -1
+                                               if it's not inside one */
+        int                     m_revision; /* the document revision the program was
+                                               compiled from, -1 if there is none */
+
+        bool isCurrent() const;         // true if the program is for what the editor has
+
+        // the IP of the instruction at position, or false if there is none
+        bool instructionAt(int position, IPType *ip) const;
+
+        /* the bracket at the cursor, or just before it, or -1. Sets *match to where the
+           other end of its loop is */
+        int bracketAtCursor(int *match) const;
+    };
+}
+#endif // BFBRACKETMATCHER_H
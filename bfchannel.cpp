@@ -0,0 +1,162 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfchannel.h"
+#include <QMutexLocker>
+#include <cstring>
+
+namespace QtBrain {
+
+    BfByteChannel::BfByteChannel(int capacity) :
+            m_buffer(NULL),
+            m_mask(roundUpToPowerOfTwo(capacity) - 1)
+    {
+        m_buffer = new char[m_mask + 1];
+    }
+
+    BfByteChannel::~BfByteChannel() {
+        delete[] m_buffer;
+    }
+
+    int BfByteChannel::roundUpToPowerOfTwo(int n) {
+        int pow = 1;
+        while(pow < n && pow < (1 << 30)) {
+            pow <<= 1;
+        }
+        return pow;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// PRODUCER SIDE
+    //////////////////
+    int BfByteChannel::freeSpace() const {
+        return capacity() - int(quint32(int(m_head)) - tail());
+    }
+
+    int BfByteChannel::write(const char *data, int len) {
+        const quint32 head = quint32(int(m_head)); // we're the only one writing it
+        const int n = qMin(len, capacity() - int(head - tail()));
+        if(n <= 0)
+            return 0;
+
+        // the free space may wrap around the end of the buffer
+        const int start = head & m_mask;
+        const int first = qMin(n, capacity() - start);
+        memcpy(m_buffer + start, data, first);
+        memcpy(m_buffer, data + first, n - first);
+
+        // publish the bytes to the consumer. Ordered, see wake()
+        m_head.fetchAndStoreOrdered(int(head + n));
+        wake(m_dataAvailable);
+        return n;
+    }
+
+    bool BfByteChannel::put(char c) {
+        return write(&c, 1) == 1;
+    }
+
+    bool BfByteChannel::waitForSpace(int msecs) {
+        if(freeSpace() > 0)
+            return true;
+
+        QMutexLocker lock(&m_mutex);
+        m_waiters.ref();
+        // the consumer checks m_waiters after reading, so check again before sleeping
+        if(freeSpace() == 0)
+            m_spaceAvailable.wait(&m_mutex, msecs);
+        m_waiters.deref();
+        return freeSpace() > 0;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// CONSUMER SIDE
+    //////////////////
+    int BfByteChannel::available() const {
+        return int(head() - quint32(int(m_tail)));
+    }
+
+    int BfByteChannel::read(char *data, int maxLen) {
+        const quint32 tail = quint32(int(m_tail)); // we're the only one writing it
+        const int n = qMin(maxLen, int(head() - tail));
+        if(n <= 0)
+            return 0;
+
+        const int start = tail & m_mask;
+        const int first = qMin(n, capacity() - start);
+        memcpy(data, m_buffer + start, first);
+        memcpy(data + first, m_buffer, n - first);
+
+        // hand the space back to the producer. Ordered, see wake()
+        m_tail.fetchAndStoreOrdered(int(tail + n));
+        wake(m_spaceAvailable);
+        return n;
+    }
+
+    QByteArray BfByteChannel::readAll() {
+        QByteArray result(available(), 0);
+        result.resize(read(result.data(), result.size()));
+        return result;
+    }
+
+    bool BfByteChannel::get(char *c) {
+        return read(c, 1) == 1;
+    }
+
+    int BfByteChannel::skip(int len) {
+        const quint32 tail = quint32(int(m_tail));
+        const int n = qMin(len, int(head() - tail));
+        if(n <= 0)
+            return 0;
+        m_tail.fetchAndStoreOrdered(int(tail + n));
+        wake(m_spaceAvailable);
+        return n;
+    }
+
+    bool BfByteChannel::waitForData(int msecs) {
+        if(available() > 0)
+            return true;
+
+        QMutexLocker lock(&m_mutex);
+        m_waiters.ref();
+        // the producer checks m_waiters after writing, so check again before sleeping
+        if(available() == 0)
+            m_dataAvailable.wait(&m_mutex, msecs);
+        m_waiters.deref();
+        return available() > 0;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// PRIVATE METHODS
+    ////////////////////
+    void BfByteChannel::wake(QWaitCondition &cond) {
+        /* the position was updated with an ordered store, and the waiter increments
+           m_waiters before checking the position again. With full barriers on both
+           sides, either we see the waiter here or it sees our update before it sleeps.
+           A release store alone could be reordered with this load on ARM or POWER, and
+           the waiter would sleep until it timed out */
+        if(m_waiters.fetchAndAddOrdered(0) == 0)
+            return;
+        QMutexLocker lock(&m_mutex);
+        cond.wakeAll();
+    }
+}
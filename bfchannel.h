@@ -0,0 +1,113 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFCHANNEL_H
+#define BFCHANNEL_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+namespace QtBrain {
+
+    /**
+      A lock-free single-producer/single-consumer ring buffer of bytes.
+
+      Used to move the VM's output from the VM's thread to whoever reads it, without a
+      queued signal per byte. Exactly one thread may write to the channel and exactly
+      one thread may read from it; they don't need to be the same thread.
+
+      The VM's input goes through a channel too, but both sides of that one are in the
+      VM's thread: input() and the input device fill it there, and an INP that finds it
+      empty waits through the VM's state machine, not waitForData().
+
+      The producer only ever advances the head and the consumer only ever advances the
+      tail, so neither side needs a lock. The positions run freely and are wrapped with
+      a mask, which is why the capacity is always a power of two.
+
+      Either side can block until the other one has done something with
+      waitForData()/waitForSpace(). The other side only touches the mutex if somebody
+      is actually waiting, so the common non-blocking case stays lock-free.
+      */
+    class BfByteChannel
+    {
+    public:
+        explicit BfByteChannel(int capacity = 1 << 16); // rounded up to a power of two
+        ~BfByteChannel();
+
+        int capacity() const { return m_mask + 1; }
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PRODUCER SIDE
+        //////////////////
+        int write(const char *data, int len);   /* writes as much of data as fits and
+                                                   returns the number of bytes written */
+        int write(const QByteArray &data) { return write(data.constData(), data.size()); }
+        bool put(char c);                       // returns false if the channel is full
+        int freeSpace() const;
+        bool waitForSpace(int msecs);           /* blocks until there's room for at least
+                                                   one byte or msecs have passed. Returns
+                                                   true if there's room */
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// CONSUMER SIDE
+        //////////////////
+        int read(char *data, int maxLen);       /* reads up to maxLen bytes and returns
+                                                   the number of bytes read */
+        QByteArray readAll();
+        bool get(char *c);                      // returns false if the channel is empty
+        int skip(int len);                      // throws away up to len bytes
+        int available() const;
+        bool waitForData(int msecs);            /* blocks until there's at least one byte
+                                                   to read or msecs have passed. Returns
+                                                   true if there's something to read */
+
+    private:
+        Q_DISABLE_COPY(BfByteChannel)
+
+        char            *m_buffer;
+        const int       m_mask;         // capacity-1
+
+        /* free running positions. Only the producer writes m_head and only the consumer
+           writes m_tail. The difference is the number of bytes in the channel */
+        mutable QAtomicInt m_head;
+        mutable QAtomicInt m_tail;
+
+        // used only for blocking
+        mutable QAtomicInt m_waiters;   // number of threads waiting on either condition
+        QMutex          m_mutex;
+        QWaitCondition  m_dataAvailable;
+        QWaitCondition  m_spaceAvailable;
+
+        static int roundUpToPowerOfTwo(int n);
+
+        // acquire loads of the positions, so the bytes they cover are visible too
+        quint32 head() const { return quint32(m_head.fetchAndAddAcquire(0)); }
+        quint32 tail() const { return quint32(m_tail.fetchAndAddAcquire(0)); }
+
+        void wake(QWaitCondition &cond);        // wakes waiters on cond, if there are any
+    };
+}
+
+#endif // BFCHANNEL_H
@@ -0,0 +1,139 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfcodeview.h"
+#include "bfbracketmatcher.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QTextBlock>
+#include <QtAlgorithms>
+
+namespace QtBrain {
+
+    BfCodeView::BfCodeView(QWidget *parent) :
+            QPlainTextEdit(parent),
+            m_matcher(NULL),
+            m_ip(-1),
+            m_loopOpen(-1),
+            m_loopClose(-1)
+    {
+        // a new program makes the old positions meaningless
+        connect(this, SIGNAL(textChanged()), this, SLOT(clearMarkers()));
+    }
+
+    void BfCodeView::setBracketMatcher(BfBracketMatcher *matcher) {
+        m_matcher = matcher;
+    }
+
+    void BfCodeView::setIp(int position) {
+        if(position == m_ip)
+            return;
+
+        int open = -1, close = -1;
+        if(position >= 0 && m_matcher != NULL)
+            m_matcher->enclosingLoop(position, &open, &close);
+
+        // only what changed is painted again
+        updateChar(m_ip);
+        updateChar(position);
+        if(open != m_loopOpen || close != m_loopClose) {
+            updateChar(m_loopOpen);
+            updateChar(m_loopClose);
+            updateChar(open);
+            updateChar(close);
+        }
+        m_ip = position;
+        m_loopOpen = open;
+        m_loopClose = close;
+
+        if(m_ip < 0)
+            return;
+
+        // scroll only if the IP isn't in sight
+        const QTextBlock block = document()->findBlock(m_ip);
+        if(!block.isVisible() || !viewport()->rect().contains(charRect(m_ip))) {
+            QTextCursor tc(document());
+            tc.setPosition(m_ip);
+            setTextCursor(tc);
+            centerCursor();
+        }
+    }
+
+    void BfCodeView::setBreakpoints(const QList<int> &positions) {
+        m_breakpoints = positions;
+        viewport()->update();
+    }
+
+    void BfCodeView::clearMarkers() {
+        m_ip = m_loopOpen = m_loopClose = -1;
+        m_breakpoints.clear();
+        viewport()->update();
+    }
+
+    QRect BfCodeView::charRect(int position) const {
+        QTextCursor tc(document());
+        tc.setPosition(position);
+        QRect r = cursorRect(tc);
+        const QChar c = document()->characterAt(position);
+        r.setWidth(qMax(fontMetrics().width(c.isPrint() ? c : QChar(QLatin1Char(' '))), 2));
+        return r;
+    }
+
+    void BfCodeView::updateChar(int position) {
+        if(position >= 0 && position < document()->characterCount())
+            viewport()->update(charRect(position).adjusted(-2, -2, 2, 2));
+    }
+
+    void BfCodeView::paintEvent(QPaintEvent *e) {
+        QPlainTextEdit::paintEvent(e);
+
+        QPainter painter(viewport());
+        const int chars = document()->characterCount();
+
+        // the breakpoints that are in view
+        const int first = cursorForPosition(QPoint(0, 0)).position();
+        const int last = cursorForPosition(QPoint(viewport()->width(),
+                                                  viewport()->height())).position();
+        QList<int>::const_iterator bp =
+                qLowerBound(m_breakpoints.constBegin(), m_breakpoints.constEnd(), first);
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(255, 0, 0, 96));
+        for(; bp != m_breakpoints.constEnd() && *bp <= last; ++bp) {
+            const QRect r = charRect(*bp);
+            if(r.intersects(e->rect()))
+                painter.drawRect(r);
+        }
+
+        painter.setBrush(Qt::NoBrush);
+        if(m_loopOpen >= 0 && m_loopClose < chars) {
+            painter.setPen(QPen(Qt::darkGreen, 1, Qt::DotLine));
+            painter.drawRect(charRect(m_loopOpen).adjusted(0, 0, -1, -1));
+            painter.drawRect(charRect(m_loopClose).adjusted(0, 0, -1, -1));
+        }
+
+        if(m_ip >= 0 && m_ip < chars) {
+            painter.setPen(QPen(Qt::blue, 2));
+            painter.drawRect(charRect(m_ip).adjusted(1, 1, -1, -1));
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFCODEVIEW_H
+#define BFCODEVIEW_H
+
+#include <QPlainTextEdit>
+#include <QList>
+#include <QRect>
+
+namespace QtBrain {
+    class BfBracketMatcher;
+
+    /**
+      Shows the program in the debugger.
+
+      The IP caret, the loop the IP is in and the breakpoints are painted on top of the
+      text instead of being made out of text cursors and selections. Moving the IP then
+      only repaints the few rectangles that changed, and the document itself is never
+      touched, so nothing has to be laid out again however fast the VM steps. The view
+      only scrolls when the IP goes somewhere that isn't visible.
+
+      All positions are positions in the text, ie. what the source map gives. -1 means
+      none.
+      */
+    class BfCodeView : public QPlainTextEdit
+    {
+        Q_OBJECT
+    public:
+        BfCodeView(QWidget *parent = 0);
+
+        // the loop around the IP is outlined if a matcher is set
+        void setBracketMatcher(BfBracketMatcher *matcher);
+
+        int ip() const { return m_ip; }
+
+    public slots:
+        void setIp(int position);
+        void setBreakpoints(const QList<int> &positions);   // sorted
+        void clearMarkers();    // forgets the IP and the breakpoints
+
+    protected:
+        void paintEvent(QPaintEvent *e);
+
+        // the rectangle of the character at position in viewport coordinates
+        QRect charRect(int position) const;
+
+        // schedules the character at position to be painted again
+        void updateChar(int position);
+
+        BfBracketMatcher    *m_matcher;
+        int                 m_ip;
+        int                 m_loopOpen;     // the [ and ] of the loop around the IP
+        int                 m_loopClose;
+        QList<int>          m_breakpoints;
+    };
+}
+#endif // BFCODEVIEW_H
@@ -23,47 +23,285 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include "bfcompiler.h"
 #include "bihash.h"
-#include <QStack>
+#include "bfblockdata.h"
+#include "bflexer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include <QVector>
+#include <QPair>
 #include <QDebug>
 
 
 
 namespace QtBrain {
 
+    namespace {
+        /* the results of compiling one piece of a chunk in compileChunkParallel().
+
+           The nesting level of a bracket is the number of loops it's inside of, counting
+           its own: the [ and ] of a loop are on the same level, and a [ and a ] on the
+           same level with no other brackets of that level in between always belong
+           together. Levels are relative to the start of the piece here, so the ]s of
+           loops opened before the piece get levels of 0 or less */
+        struct PieceResult {
+            QVector<BfOpcode>       ops;
+            QVector<quint32>        positions;  // in the whole source
+            int                     net;        // the depth at the end of the piece
+            int                     minLevel;   // the lowest level in levels
+            QVector<QVector<int> >  levels;     /* op indexes of the brackets on each
+                                                   level, in order. levels[0] is
+                                                   minLevel */
+
+            const QVector<int> *level(int lv) const {
+                const int i = lv - minLevel;
+                return i >= 0 && i < levels.size() ? &levels[i] : NULL;
+            }
+        };
+
+        struct Piece {
+            const char  *data;
+            qint64      len;
+            quint64     offset;
+        };
+
+        struct CompilePiece {
+            typedef PieceResult result_type;
+
+            PieceResult operator()(const Piece &piece) const {
+                PieceResult r;
+                r.net = 0;
+                r.minLevel = 0;
+                QVector<QPair<int,int> > brackets;  // (level, op index)
+                int maxLevel = 0;
+
+                BfLexer::scan(piece.data, int(piece.len), quint32(piece.offset),
+                              r.ops, r.positions);
+                for(int i = 0; i < r.ops.size(); ++i) {
+                    if(r.ops[i] == JZ) {
+                        ++r.net;
+                        brackets.append(qMakePair(r.net, i));
+                        maxLevel = qMax(maxLevel, r.net);
+                    } else if(r.ops[i] == JNZ) {
+                        brackets.append(qMakePair(r.net, i));
+                        r.minLevel = qMin(r.minLevel, r.net);
+                        --r.net;
+                    }
+                }
+
+                r.levels.resize(maxLevel - r.minLevel + 1);
+                for(int i = 0; i < brackets.size(); ++i)
+                    r.levels[brackets[i].first - r.minLevel].append(brackets[i].second);
+                return r;
+            }
+        };
+
+        // the loops found on one nesting level in compileChunkParallel()
+        struct LevelResult {
+            QVector<QPair<IPType,IPType> >  pairs;  // JZ, JNZ
+            bool                            open;   // a [ on this level is left open...
+            IPType                          openJz; // ...and this is it
+        };
+
+        struct MatchLevel {
+            typedef LevelResult result_type;
+
+            const QVector<PieceResult>  *pieces;
+            const QVector<int>          *depths;    // the depth at the start of each piece
+            const QVector<IPType>       *bases;     // the IP of the first op of each piece
+            const QStack<IPType>        *carried;   // [s left open by earlier chunks
+
+            LevelResult operator()(int level) const {
+                LevelResult r;
+                r.open = level <= carried->size();
+                r.openJz = r.open ? carried->at(level - 1) : 0;
+
+                /* the brackets of a level alternate between [ and ] in source order, so
+                   each ] belongs to the [ right before it */
+                for(int p = 0; p < pieces->size(); ++p) {
+                    const PieceResult &piece = pieces->at(p);
+                    const QVector<int> *brackets = piece.level(level - depths->at(p));
+                    if(brackets == NULL)
+                        continue;
+                    for(int i = 0; i < brackets->size(); ++i) {
+                        const int idx = brackets->at(i);
+                        const IPType ip = bases->at(p) + idx;
+                        if(piece.ops[idx] == JZ) {
+                            r.openJz = ip;
+                            r.open = true;
+                        } else {
+                            r.pairs.append(qMakePair(r.openJz, ip));
+                            r.open = false;
+                        }
+                    }
+                }
+                return r;
+            }
+        };
+    }
+
     BfCompiler::BfCompiler(QObject *parent) :
             QThread(parent),
-            m_error(false)
+            m_error(false),
+            m_errorPos(0),
+            m_preparedDoc(NULL),
+            m_preparedRevision(-1),
+            m_assemblyDoc(NULL)
     {
+        connect(&m_assemblyWatcher, SIGNAL(finished()), this, SLOT(documentAssembled()));
     }
 
     BfCompiler::~BfCompiler() {
         qDebug("~BfCompiler()");
     }
 
+    void BfCompiler::setCacheDirectory(const QString &directory) {
+        m_cache.setDirectory(directory);
+    }
+
     /////////////////////////////////////////////////////////////////////////////////////
     //// SLOTS FOR EXTERNAL USE
     ///////////////////////////
     void BfCompiler::compile(const QString& src) {
-        m_error = false;
-        BiHash<IPType, quint32> mappings;
-        BiHash<IPType,IPType> jmps;
+        beginCompile();
+        /* only Latin-1 characters can be commands, and every QChar becomes exactly one
+           byte so the positions stay the same */
+        const QByteArray latin = src.toLatin1();
+        compileChunk(latin.constData(), latin.size(), 0);
+        finishCompile();
+    }
 
-        QList<BfOpcode> bytecode = compileSource(src, mappings);
+    void BfCompiler::compileDocument(QTextDocument *doc) {
+        // usually prepareDocument() has already done all the work
+        prepare(doc);
+        emitResult();
+    }
+
+    void BfCompiler::prepareDocument(QTextDocument *doc) {
+        m_assemblyDoc = doc;
+        // whatever changes meanwhile is picked up when it's done
+        if(m_assemblyWatcher.isRunning())
+            return;
 
-        if(bytecode.isEmpty()) {
-            qDebug("BfCompiler::compile() no valid Bf in source");
-            emit error(trUtf8("There were no valid Brainfuck commands in the source"),0);
+        if(doc == m_preparedDoc && doc->revision() == m_preparedRevision) {
+            // compileDocument() got here first
+            if(!m_error)
+                emit prepared(m_jmps, m_mappings);
             return;
         }
 
-        jmps = memoizeJumps(bytecode, mappings);
-        if(m_error) {
-            qDebug("BfCompiler::compile() encountered an error in the source");
+        /* putting the program together takes as long as the program is, so it's done
+           in another thread from a snapshot. documentAssembled() takes it from there */
+        m_assemblyWatcher.setFuture(QtConcurrent::run(&BfCompiler::assemble,
+                                                      snapshot(doc, false)));
+    }
+
+    void BfCompiler::documentAssembled() {
+        const Assembly assembly = m_assemblyWatcher.result();
+        QTextDocument *doc = m_assemblyDoc;
+        if(assembly.doc != doc) {
+            prepareDocument(doc);
+            return;
+        }
+
+        /* keep what was lexed. Lines may have been edited, added or removed meanwhile,
+           but the results are good for any line that still has the same text */
+        for(int i = 0; i < assembly.blocks.size(); ++i) {
+            const DocumentBlock &lexed = assembly.blocks[i];
+            if(!lexed.stale)
+                continue;
+            QTextBlock block = doc->findBlockByNumber(lexed.number);
+            if(block.isValid() && !BfBlockData::isCompiled(block)
+                    && block.text() == lexed.text)
+                BfBlockData::store(block, lexed.data);
+        }
+
+        // the program is only good for the document as it was
+        if(doc->revision() != assembly.revision) {
+            prepareDocument(doc);
             return;
         }
 
-        emit compiled(bytecode,jmps,mappings);
+        adopt(assembly);
+        if(!m_error)
+            emit prepared(m_jmps, m_mappings);
+    }
+
+    void BfCompiler::compileFile(const QString &fileName) {
+        beginCompile();
+        QFile file(fileName);
+        if(!file.open(QIODevice::ReadOnly)) {
+            fail(trUtf8("Error reading file %1: %2").arg(fileName).arg(file.errorString()),
+                 0);
+            finishCompile();
+            return;
+        }
+
+        // an unchanged file has been compiled before
+        const QFileInfo info(file);
+        if(m_cache.isEnabled()) {
+            const QByteArray hash = m_cache.lookup(info);
+            if(!hash.isEmpty() && m_cache.load(hash, m_bytecode, m_jmps, m_mappings)) {
+                qDebug("BfCompiler::compileFile() %s loaded from the cache",
+                       qPrintable(fileName));
+                if(m_mappings.size() > COMPRESS_MAPPINGS_THRESHOLD)
+                    m_mappings.compress();
+                emitResult();
+                beginCompile();
+                return;
+            }
+            beginCompile();     // a failed load may have left something behind
+        }
+
+        const qint64 size = file.size();
+        qint64 offset = 0;
+        // the cache wants the hash of the source, which is taken on the same pass
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+
+        // map the file a window at a time, so even huge files don't eat the address space
+        while(offset < size) {
+            const qint64 len = qMin(size - offset, qint64(MAP_WINDOW));
+            uchar *window = file.map(offset, len);
+            if(window == NULL)
+                break;  // can't be mapped, read the rest instead
+            const bool ok = compileChunk(reinterpret_cast<const char*>(window), len, offset);
+            if(ok && m_cache.isEnabled())
+                hash.addData(reinterpret_cast<const char*>(window), int(len));
+            file.unmap(window);
+            if(!ok) {
+                finishCompile();
+                return;
+            }
+            offset += len;
+        }
+
+        if(offset < size) {
+            qDebug("BfCompiler::compileFile() reading %s from %lld", qPrintable(fileName),
+                   offset);
+            file.seek(offset);
+            QByteArray chunk;
+            while(!(chunk = file.read(READ_CHUNK)).isEmpty()) {
+                if(!compileChunk(chunk.constData(), chunk.size(), offset))
+                    break;
+                if(m_cache.isEnabled())
+                    hash.addData(chunk);
+                offset += chunk.size();
+            }
+        }
 
+        checkProgram();
+        // only programs that compiled are worth keeping
+        if(!m_error && m_cache.isEnabled() && offset == size) {
+            const QByteArray result = hash.result();
+            if(m_cache.store(result, m_bytecode, m_jmps, m_mappings))
+                m_cache.remember(info, result);
+        }
+        emitResult();
+        beginCompile();
     }
 
 
@@ -71,87 +309,314 @@ namespace QtBrain {
     //// PROTECTED METHODS
     //////////////////////
 
-    BfOpcode BfCompiler::charToOpcode(const QChar &chr) {
-        switch(chr.toAscii()) {
-        case '>':
-            return DPINC;
-        case '<':
-            return DPDEC;
-        case '+':
-            return ADD;
-        case '-':
-            return SUB;
-        case '.':
-            return OUT;
-        case ',':
-            return INP;
-        case '[':
-            return JZ;
-        case ']':
-            return JNZ;
-        case '%':
-            return BRK;
-        default:
-            return INVALID;
-        }
-    }
-
-    QList<BfOpcode> BfCompiler::compileSource(const QString &src, BiHash<IPType, quint32> &mappings) {
-        QList<BfOpcode> bytecode;
-
-        int srclen = src.size();
-        BfOpcode temp;
-
-        for(int i = 0; i < srclen ; ++i) {
-            temp = charToOpcode(src[i]);
-            if(temp != INVALID) { // Found a valid command at position i
-                //               v position in cleaned source
-                mappings.insert(bytecode.size(), i);
-                //                               ^ position in original
-                bytecode.append(temp);
-            }
+    BfOpcode BfCompiler::charToOpcode(char chr) {
+        return BfLexer::opcode(chr);
+    }
+
+    void BfCompiler::beginCompile() {
+        m_error = false;
+        m_errorMessage.clear();
+        m_errorPos = 0;
+        m_bytecode.clear();
+        m_jmps.clear();
+        m_mappings.clear();
+        m_jzs.clear();
+        // whatever was prepared is gone now
+        m_preparedDoc = NULL;
+    }
+
+    void BfCompiler::fail(const QString &message, quint32 position) {
+        qDebug() << "BfCompiler::fail()" << message << position;
+        m_error = true;
+        m_errorMessage = message;
+        m_errorPos = position;
+    }
+
+    bool BfCompiler::compileChunk(const char *data, qint64 len, quint64 offset) {
+        if(offset + len > quint64(0xffffffffu)) {
+            // source positions are 32 bits
+            fail(trUtf8("The source is too large"), 0xffffffffu);
+            return false;
         }
-        return bytecode;
 
+        if(len >= PARALLEL_THRESHOLD && QThread::idealThreadCount() > 1)
+            return compileChunkParallel(data, len, offset);
+
+        /* the lexer finds the commands a block at a time, and they're compiled from
+           there */
+        QVector<BfOpcode> ops;
+        QVector<quint32> positions;
+        for(qint64 start = 0; start < len; start += LEX_BLOCK) {
+            ops.clear();
+            positions.clear();
+            BfLexer::scan(data + start, int(qMin(len - start, qint64(LEX_BLOCK))),
+                          quint32(offset + start), ops, positions);
+            if(!compileOps(ops, positions))
+                return false;
+        }
+        return true;
     }
 
-    BiHash<IPType,IPType> BfCompiler::memoizeJumps(const QList<BfOpcode> &program,
-                                                   BiHash<IPType, quint32> &mappings) {
-        QStack<IPType> jzs;
-        BiHash<IPType,IPType> jmps;
-        DPType programSize = program.size();
-        /* scan program, push location of JZs encountered on stack. When a
-           JNZ is encountered, pop a location from the stack and add the popped JZ location
-           and the IP of the JNZ to the m_jmps BiHash.*/
-        for(IPType i = 0; i < programSize; ++i) {
-            if(program[i] == JZ) {
-                qDebug() << "BfCompiler::memoizeJumps() JZ at"<<i;
-                jzs.push(i);
-                continue;
+    bool BfCompiler::compileOps(const QVector<BfOpcode> &ops,
+                                const QVector<quint32> &positions) {
+        for(int i = 0; i < ops.size(); ++i) {
+            const BfOpcode op = ops[i];
+            const IPType ip = m_bytecode.size();
+            const quint32 pos = positions[i];
+            if(ip == IPType(MAX_PROGRAM_SIZE)) {
+                fail(trUtf8("The program is too large"), pos);
+                return false;
             }
 
-            if(program[i] == JNZ) {
-                qDebug() << "BfCompiler::memoizeJumps() JNZ at"<<i;
-                if(jzs.isEmpty()) {
-                    qDebug("BfCompiler::memoizeJumps() brace mismatch at %d",i);
-                    emit error(trUtf8("Brace mismatch: too many ]s"), mappings.value(i));
-                    m_error = true;
-                    return BiHash<IPType,IPType>();
+            /* scan program, push location of JZs encountered on stack. When a
+               JNZ is encountered, pop a location from the stack and add the popped JZ
+               location and the IP of the JNZ to the jumps */
+            if(op == JZ) {
+                m_jzs.push(ip);
+            } else if(op == JNZ) {
+                if(m_jzs.isEmpty()) {
+                    qDebug("BfCompiler::compileOps() brace mismatch at %u", pos);
+                    fail(trUtf8("Brace mismatch: too many ]s"), pos);
+                    return false;
                 }
+                m_jmps.insert(m_jzs.pop(), ip);
+            }
+
+            // the position in the original source of the command at ip
+            m_mappings.append(pos);
+            m_bytecode.append(op);
+        }
+        return true;
+    }
+
+    /**
+      Compiles a chunk in four steps:
+
+      1. The chunk is split into pieces, and each piece is compiled by itself on some
+         core. Besides the bytecode, that gives the depth at the end of the piece and the
+         brackets on each nesting level, relative to the start of the piece.
+      2. A prefix sum over the pieces gives the depth at the start of each piece, and with
+         that the real levels of their brackets. This is also where ]s without a [ show
+         up: they end up on level 0.
+      3. The bytecode and the source positions are appended to the program.
+      4. The brackets are matched. The [s and ]s of a level simply alternate, so every
+         level can be matched on its own, on some core.
+
+      The [s left open at the end are carried to the next chunk in m_jzs, one per level,
+      the same as in the single threaded version.
+      */
+    bool BfCompiler::compileChunkParallel(const char *data, qint64 len, quint64 offset) {
+        const int count = QThread::idealThreadCount() * 4;
+        const qint64 pieceLen = len / count + 1;
+        QVector<Piece> pieces;
+        for(qint64 start = 0; start < len; start += pieceLen) {
+            Piece piece = {data + start, qMin(pieceLen, len - start), offset + start};
+            pieces.append(piece);
+        }
+
+        // 1.
+        const QVector<PieceResult> results =
+                QtConcurrent::blockingMapped<QVector<PieceResult> >(pieces, CompilePiece());
+
+        // 2.
+        QVector<int> depths(results.size());
+        QVector<IPType> bases(results.size());
+        int depth = m_jzs.size();
+        quint64 ip = m_bytecode.size();
+        int maxLevel = depth;
+        for(int p = 0; p < results.size(); ++p) {
+            const PieceResult &piece = results[p];
+            depths[p] = depth;
+            bases[p] = IPType(ip);
+
+            // the first ] that would take the depth below 0 has nothing to close
+            const QVector<int> *unmatched = piece.level(-depth);
+            if(unmatched != NULL) {
+                for(int i = 0; i < unmatched->size(); ++i) {
+                    const int idx = unmatched->at(i);
+                    if(piece.ops[idx] == JNZ) {
+                        qDebug("BfCompiler::compileChunkParallel() brace mismatch at %u",
+                               piece.positions[idx]);
+                        fail(trUtf8("Brace mismatch: too many ]s"), piece.positions[idx]);
+                        return false;
+                    }
+                }
+            }
+
+            maxLevel = qMax(maxLevel, depth + piece.minLevel + piece.levels.size() - 1);
+            depth += piece.net;
+            ip += piece.ops.size();
+        }
+
+        if(ip > quint64(MAX_PROGRAM_SIZE)) {
+            fail(trUtf8("The program is too large"), quint32(offset + len - 1));
+            return false;
+        }
+
+        // 3.
+        for(int p = 0; p < results.size(); ++p) {
+            const PieceResult &piece = results[p];
+            for(int i = 0; i < piece.ops.size(); ++i)
+                m_bytecode.append(piece.ops[i]);
+            m_mappings.append(piece.positions.constData(), piece.positions.size());
+        }
+
+        // 4.
+        QVector<int> levels;
+        for(int lv = 1; lv <= maxLevel; ++lv)
+            levels.append(lv);
+        MatchLevel match = {&results, &depths, &bases, &m_jzs};
+        const QVector<LevelResult> matched =
+                QtConcurrent::blockingMapped<QVector<LevelResult> >(levels, match);
 
-                jmps.insert(jzs.pop(), i);
+        // every jump of the chunk goes below ip, so the jump table only grows once
+        m_jmps.reserve(int(ip));
+        QStack<IPType> open;
+        for(int i = 0; i < matched.size(); ++i) {
+            const LevelResult &level = matched[i];
+            for(int j = 0; j < level.pairs.size(); ++j)
+                m_jmps.insert(level.pairs[j].first, level.pairs[j].second);
+            // only the levels up to the final depth have a [ left open
+            if(i < depth) {
+                Q_ASSERT(level.open);
+                open.push(level.openJz);
             }
         }
+        m_jzs = open;
+        return true;
+    }
 
-        if(!jzs.isEmpty()) {
-            IPType errPos = jzs.pop();
-            qDebug("BfCompiler::memoizeJumps() brace mismatch at %d", errPos);
-            emit error(trUtf8("Brace mismatch: too many [s"), mappings.value(errPos));
-            m_error = true;
-            return BiHash<IPType,IPType>();
+    void BfCompiler::finishCompile() {
+        checkProgram();
+        emitResult();
+        // whoever wanted the results has copied them by now
+        beginCompile();
+    }
+
+    void BfCompiler::checkProgram() {
+        if(m_error)
+            return;
+
+        if(m_bytecode.isEmpty()) {
+            qDebug("BfCompiler::checkProgram() no valid Bf in source");
+            fail(trUtf8("There were no valid Brainfuck commands in the source"), 0);
+            return;
+        }
+
+        if(!m_jzs.isEmpty()) {
+            IPType errPos = m_jzs.top();
+            qDebug("BfCompiler::checkProgram() brace mismatch at %u", errPos);
+            fail(trUtf8("Brace mismatch: too many [s"), m_mappings.value(errPos));
+            return;
         }
-        qDebug() << "BfCompiler: (JZ,JNZ)" << jmps.lhash();
-        return jmps;
+
+        if(m_mappings.size() > COMPRESS_MAPPINGS_THRESHOLD)
+            m_mappings.compress();
+    }
+
+    void BfCompiler::emitResult() {
+        if(m_error) {
+            emit error(m_errorMessage, m_errorPos);
+            return;
+        }
+        qDebug("BfCompiler::emitResult() %d instructions", m_bytecode.size());
+        emit compiled(m_bytecode, m_jmps, m_mappings);
+    }
+
+    bool BfCompiler::prepare(QTextDocument *doc) {
+        if(doc == m_preparedDoc && doc->revision() == m_preparedRevision)
+            return !m_error;
+
+        adopt(assemble(snapshot(doc, true)));
+        return !m_error;
+    }
+
+    BfCompiler::Assembly BfCompiler::snapshot(QTextDocument *doc, bool lex) const {
+        Assembly assembly;
+        assembly.doc = doc;
+        assembly.revision = doc->revision();
+        assembly.blocks.reserve(doc->blockCount());
+
+        // the stored results are shared with the lines, so copying them is cheap
+        for(QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+            DocumentBlock b;
+            b.number = block.blockNumber();
+            b.position = block.position();
+            b.stale = !lex && !BfBlockData::isCompiled(block);
+            if(b.stale)
+                b.text = block.text();
+            else
+                b.data = *BfBlockData::of(block);
+            assembly.blocks.append(b);
+        }
+        return assembly;
+    }
+
+    BfCompiler::Assembly BfCompiler::assemble(Assembly assembly) {
+        assembly.error = false;
+        assembly.errorPos = 0;
+        QtConcurrent::blockingMap(assembly.blocks, &BfCompiler::lexBlock);
+
+        /* put the program together from the lines. Everything in them is relative to
+           the line, so it's just moved to where the line is now */
+        for(int b = 0; b < assembly.blocks.size(); ++b) {
+            const BfBlockData &data = assembly.blocks[b].data;
+            const IPType base = assembly.bytecode.size();
+            const quint32 start = assembly.blocks[b].position;
+
+            if(quint64(base) + data.ops.size() > quint64(MAX_PROGRAM_SIZE)) {
+                assembly.error = true;
+                assembly.errorMessage = trUtf8("The program is too large");
+                assembly.errorPos = start;
+                break;
+            }
+
+            for(int i = 0; i < data.ops.size(); ++i) {
+                assembly.mappings.append(start + data.positions[i]);
+                assembly.bytecode.append(data.ops[i]);
+            }
+            for(int i = 0; i < data.pairs.size(); ++i)
+                assembly.jmps.insert(base + data.pairs[i].first,
+                                     base + data.pairs[i].second);
+
+            // ]s close the [s left open by earlier lines...
+            for(int i = 0; i < data.openJnzs.size(); ++i) {
+                const IPType jnz = base + data.openJnzs[i];
+                if(assembly.jzs.isEmpty()) {
+                    assembly.error = true;
+                    assembly.errorMessage = trUtf8("Brace mismatch: too many ]s");
+                    assembly.errorPos = assembly.mappings.value(jnz);
+                    break;
+                }
+                assembly.jmps.insert(assembly.jzs.pop(), jnz);
+            }
+            if(assembly.error)
+                break;
+            // ...and [s wait for later ones
+            for(int i = 0; i < data.openJzs.size(); ++i)
+                assembly.jzs.push(base + data.openJzs[i]);
+        }
+        return assembly;
+    }
+
+    void BfCompiler::lexBlock(DocumentBlock &block) {
+        if(block.stale)
+            block.data.compile(block.text);
+    }
+
+    void BfCompiler::adopt(const Assembly &assembly) {
+        // the containers are shared, so none of this copies the program
+        beginCompile();
+        m_bytecode = assembly.bytecode;
+        m_jmps = assembly.jmps;
+        m_mappings = assembly.mappings;
+        m_jzs = assembly.jzs;
+        if(assembly.error)
+            fail(assembly.errorMessage, assembly.errorPos);
+        checkProgram();
+
+        m_preparedDoc = assembly.doc;
+        m_preparedRevision = assembly.revision;
     }
 
 
@@ -25,8 +25,17 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define BFCOMPILER_H
 
 #include "bfvm.h"
+#include "bfsourcemap.h"
+#include "bfprogramcache.h"
+#include "bfblockdata.h"
 #include <QObject>
 #include <QList>
+#include <QStack>
+#include <QVector>
+#include <QString>
+#include <QFutureWatcher>
+
+class QTextDocument;
 
 
 namespace QtBrain {
@@ -35,16 +44,35 @@ namespace QtBrain {
       This class is used to compile "normal" Brainfuck into the VM's internal binary
       representation
 
-      This is done by first cleaning the input source file so that the only characters left
-      are the 8 legal Brainfuck commands +-<>[],.
-      Then the string is read a character at a time and "compiled" into BfVM bytecode (which
-      can be found in the BfVM header). If the source can't be compiled for whatever reason,
-      a signal is emitted with a message and a guess of where the error might be.
+      This is done in a single pass over the source: every character that is one of the
+      legal Brainfuck commands +-<>[],. (or the % breakpoint) is "compiled" into BfVM
+      bytecode (which can be found in the BfVM header), its position is recorded and the
+      jumps are matched as they are found. Everything else is skipped, which effectively
+      cleans the source. If the source can't be compiled for whatever reason, a signal is
+      emitted with a message and a guess of where the error might be.
+
+      Since the pass only ever looks at one character at a time, the source doesn't have
+      to be in memory all at once: compileFile() maps the file a window at a time, or
+      reads it in chunks if it can't be mapped. The positions are then byte offsets in
+      the file.
+
+      Programs compiled by compileFile() are kept in a BfProgramCache, and an unchanged
+      file is loaded from there instead of being compiled again.
+
+      compileDocument() compiles a QTextDocument incrementally instead. The results for
+      each line are kept in the line itself (see BfBlockData), and only the lines that
+      changed since the last compile are looked at again. The rest is pieced together
+      from what's stored. prepareDocument() does the same without emitting anything, so
+      it can be run in the background while the user edits. It takes a snapshot of the
+      document, which copies the stored results and the text of the changed lines, and
+      both the lexing and piecing the program together happen in another thread. The
+      document's thread only takes the snapshot, stores the new results in the lines
+      and takes the finished program over.
 
       When compilaton finishes, the compiler emits the following:
       - bytecode of the compiled program
       - a BiHash of the JZ/JNZ instruction positions
-      - a BiHash of how the generated bytecode "maps" into the original source code:
+      - a BfSourceMap of how the generated bytecode "maps" into the original source code:
 
           For example, if the source was this:
           [ < + >]
@@ -57,12 +85,12 @@ namespace QtBrain {
           Position 4 in the cleaned source would then _map_ to position 7 in the original,
           position 2 of the cleaned would map to position 4 of the original and so on.
 
-          the "left" side of the BiHash is the position in the cleaned source, and the
-          "right" side is the original.
+          the keys of the BfSourceMap are the positions in the cleaned source, and the
+          values are the original ones.
 
 
       What the compiler checks for:
-      - Is the program smaller than the maximum size allowed by the VM?
+      - Is the program smaller than MAX_PROGRAM_SIZE?
       - Are all braces matched?
 
       */
@@ -78,6 +106,35 @@ namespace QtBrain {
         BfCompiler(QObject *parent = 0);
         ~BfCompiler();
 
+        /**
+          Returns the opcode that corresponds to the given character, or INVALID if
+          it's not a valid Bf command
+          */
+        static BfOpcode charToOpcode(char);
+
+        /**
+          Sets where compileFile() keeps the compiled programs. An empty directory turns
+          the cache off. The default is BfProgramCache::defaultDirectory().
+          */
+        void setCacheDirectory(const QString &directory);
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PUBLIC MEMBERS
+        ///////////////////
+        static const int MAX_PROGRAM_SIZE = 0x7fffffff; /* the most instructions a program
+                                                           can have. QList can't hold more */
+        static const qint64 MAP_WINDOW = 64 << 20;  // how much of a file is mapped at once
+        static const qint64 READ_CHUNK = 1 << 20;   /* how much of a file is read at once
+                                                       if it can't be mapped */
+        static const qint64 LEX_BLOCK = 1 << 16;    /* how much source is lexed at a time
+                                                       when compiling on one core */
+        static const int COMPRESS_MAPPINGS_THRESHOLD = 1 << 24;
+                                                    /* programs with more instructions than
+                                                       this get their source map compressed,
+                                                       see BfSourceMap */
+        static const qint64 PARALLEL_THRESHOLD = 1 << 20;/* chunks at least this large are
+                                                            compiled on all cores */
+
     signals:
         /////////////////////////////////////////////////////////////////////////////////////
         //// SIGNALS
@@ -94,54 +151,137 @@ namespace QtBrain {
 
 
         void compiled(const QList<BfOpcode>&, BiHash<IPType,IPType> &jmps,
-                      BiHash<IPType,quint32> &mappings);
+                      BfSourceMap &mappings);
                                                     /* emitted when compilation succeeds.
                                                        Contains the compiled program, a
                                                        BiHash of JZ and JNZ locations and
-                                                       a BiHash of the mappings between
+                                                       a BfSourceMap of the mappings between
                                                        the original source and the cleaned
                                                        source (see comments for explanation)
                                                        */
 
+        void prepared(const BiHash<IPType,IPType> &jmps, const BfSourceMap &mappings);
+                                                    /* emitted when prepareDocument()
+                                                       succeeds, with the jumps and the
+                                                       source map of the document as it is
+                                                       now. For keeping editor features
+                                                       that need them up to date */
+
     protected:
         /////////////////////////////////////////////////////////////////////////////////////
         //// PROTECTED MEMBER VARIABLES
         ///////////////////////////////
 
         bool m_error; // set when an error is found
+        QString m_errorMessage;             // what the error was...
+        quint32 m_errorPos;                 // ...and where
 
         /////////////////////////////////////////////////////////////////////////////////////
         //// PROTECTED METHODS
         //////////////////////
         void run();                                 // QThread
 
+        /* the state of a compilation pass. The source is fed to compileChunk() in as
+           many pieces as it takes, and finishCompile() checks what's left over and
+           emits the result */
+        QList<BfOpcode>         m_bytecode;
+        BiHash<IPType,IPType>   m_jmps;     // JZ -> JNZ
+        BfSourceMap             m_mappings; // bytecode -> source position
+        QStack<IPType>          m_jzs;      // the JZs still waiting for their JNZ
+
+        BfProgramCache          m_cache;    // programs compiled by compileFile()
+
+        const QTextDocument     *m_preparedDoc;     /* the compilation state is the result
+                                                       of compiling this document... */
+        int                     m_preparedRevision; // ...at this revision
+
+        // one line of a document snapshot, see assemble()
+        struct DocumentBlock {
+            int                 number;     // QTextBlock::blockNumber()
+            quint32             position;   // QTextBlock::position()
+            bool                stale;      // true if the line has to be lexed from...
+            QString             text;       // ...this. Empty if it doesn't
+            BfBlockData         data;
+        };
+
+        /* a document snapshot, and the program put together from it. The fields are the
+           same as the compilation state's, which takes them over in adopt() */
+        struct Assembly {
+            const QTextDocument     *doc;
+            int                     revision;   // of doc when the snapshot was taken
+            QVector<DocumentBlock>  blocks;
+
+            QList<BfOpcode>         bytecode;
+            BiHash<IPType,IPType>   jmps;
+            BfSourceMap             mappings;
+            QStack<IPType>          jzs;
+            bool                    error;
+            QString                 errorMessage;
+            quint32                 errorPos;
+        };
+
+        QTextDocument           *m_assemblyDoc;     // the document prepareDocument() is for
+        QFutureWatcher<Assembly> m_assemblyWatcher;
+
+        void beginCompile();                // clears the compilation state
+
+        void fail(const QString &message, quint32 position);
+                                            // records an error, see emitResult()
+
         /**
-          compiles a string into BfVM bytecode, returns the bytecodes and a mapping from
-          the original source into the "cleaned" source in the reference &mappings.
+          Compiles len bytes of source that start at position offset of the whole source.
+          Emits an error and returns false if it finds a ] without a [ or the program
+          gets too large.
+          */
+        bool compileChunk(const char *data, qint64 len, quint64 offset);
 
-          &mappings needs to be initialized by the calling function!
+        // compiles the commands the lexer found in a chunk, see compileChunk()
+        bool compileOps(const QVector<BfOpcode> &ops, const QVector<quint32> &positions);
 
+        /**
+          compileChunk() for large chunks. The chunk is split into pieces that are
+          compiled on all cores, and the brackets are matched one nesting level at a time,
+          also on all cores. See the .cpp for how.
           */
-        QList<BfOpcode> compileSource(const QString& src, BiHash<IPType,quint32> &mappings);
+        bool compileChunkParallel(const char *data, qint64 len, quint64 offset);
 
         /**
-          Returns the opcode that corresponds to the given character, or INVALID if
-          it's not a valid Bf command
+          Checks the program, emits either compiled() or error() and clears the
+          compilation state.
           */
-        BfOpcode charToOpcode(const QChar&);
+        void finishCompile();
+
+        // records an error if there was nothing to compile or a [ is left open
+        void checkProgram();
 
+        void emitResult();                  /* emits error() if an error was recorded,
+                                               compiled() otherwise */
 
         /**
-          Memoizes destinations for the JZ and JNZ operators. Will emit an error if it
-          finds unbalanced jumps.
+          Brings the compilation state up to date with doc and returns false if there
+          was an error. Does nothing if doc hasn't changed since the last time.
+          */
+        bool prepare(QTextDocument *doc);
 
-          The mapping data is passed in so that a proper error message can be sent.
+        /**
+          Takes a snapshot of doc to be assembled. With lex, the changed lines are lexed
+          right away, otherwise only their text is copied for assemble().
+          */
+        Assembly snapshot(QTextDocument *doc, bool lex) const;
 
-          Returns an empty BiHash if it finds an error.
+        /**
+          Lexes the stale lines of the snapshot and puts the program together. Doesn't
+          touch the document, so this can be run in any thread.
           */
-        //      JZ     JNZ
-        BiHash<IPType,IPType> memoizeJumps(const QList<BfOpcode>&, BiHash<IPType, quint32>
-                                           &mappings);
+        static Assembly assemble(Assembly assembly);
+
+        static void lexBlock(DocumentBlock &block); // lexes the line if it's stale
+
+        void adopt(const Assembly &assembly);       // makes it the compilation state
+
+    protected slots:
+        void documentAssembled();           /* takes over what prepareDocument() put
+                                               together in the background */
 
 
 
@@ -156,6 +296,21 @@ namespace QtBrain {
                                                        compilation is stopped and no
                                                        further errors are reported. */
 
+        void compileFile(const QString &fileName);  /* like compile(), but reads the
+                                                       source straight from the file
+                                                       without ever holding all of it in
+                                                       memory */
+
+        void compileDocument(QTextDocument *doc);   /* like compile(), but only compiles
+                                                       what has changed since the last
+                                                       time. Has to be called from doc's
+                                                       thread */
+
+        void prepareDocument(QTextDocument *doc);   /* does the work of compileDocument()
+                                                       but only emits prepared(). The
+                                                       work is done in other threads, so
+                                                       this returns before it's done */
+
 
 
 
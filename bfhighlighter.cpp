@@ -22,24 +22,60 @@ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVE
 ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include "bfhighlighter.h"
-#include "bihash.h"
+#include "bfblockdata.h"
+#include <QPlainTextEdit>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTimer>
+#include <QtConcurrentRun>
 #include <QDebug>
-#include <algorithm>
 
 
 namespace QtBrain {
 
+    namespace {
+        /* the depth at the start of each block of text and at the end of the last one.
+           Runs in the background, so it works on a copy of the text instead of the
+           document. The copy has to come from QTextCursor::selectedText(), which
+           separates the blocks with QChar::ParagraphSeparator and leaves the soft line
+           breaks (QChar::LineSeparator) alone. toPlainText() turns both into '\n' */
+        QVector<int> computeDepths(const QString &text) {
+            QVector<int> depths;
+            int depth = -1;
+            depths.append(depth);
+            const QChar *c = text.constData();
+            const QChar *end = c + text.size();
+            for(; c != end; ++c) {
+                switch(c->unicode()) {
+                case '[':
+                    ++depth;
+                    break;
+                case ']':
+                    --depth;
+                    break;
+                case QChar::ParagraphSeparator:
+                    depths.append(depth);
+                    break;
+                }
+            }
+            depths.append(depth);
+            return depths;
+        }
+    }
 
-    BfHighlighter::BfHighlighter(QTextDocument *parent) :
-            QSyntaxHighlighter(parent),
+    BfHighlighter::BfHighlighter(QPlainTextEdit *editor) :
+            QObject(editor),
+            m_editor(editor),
+            m_doc(editor->document()),
+            m_paintTimer(new QTimer(this)),
+            m_computedRevision(-1),
+            m_painting(false),
             m_blockColor(Qt::white),
             m_colorStep(63) // 255/63 gives 4 levels of indentation before the color "rolls over"
     {
         //HighlightRule rule;
 
-        m_startBlockExp.setPattern(tr("\\["));
-        m_endBlockExp.setPattern(tr("\\]"));
-
         // the default background format
         m_blockFormat.setBackground(m_blockColor);
 
@@ -74,117 +110,188 @@ namespace QtBrain {
         rule.format = m_addSubFormat;
         m_rules.append(rule);
 */
+
+        m_paintTimer->setSingleShot(true);
+        m_paintTimer->setInterval(0);
+        connect(m_paintTimer, SIGNAL(timeout()), this, SLOT(paintVisible()));
+
+        connect(m_doc, SIGNAL(contentsChange(int,int,int)), this,
+                SLOT(contentsChange(int,int,int)));
+        connect(&m_depthWatcher, SIGNAL(finished()), this, SLOT(depthsComputed()));
+        // scrolling and resizing. Edits are handled by contentsChange()
+        connect(m_editor, SIGNAL(updateRequest(QRect,int)), this,
+                SLOT(viewportUpdated(QRect,int)));
+
+        recomputeDepths();
         qDebug() << "BfHighlighter::BfHighlighter()";
     }
 
 
-    void BfHighlighter::highlightBlock(const QString &text) {
-        int currState = previousBlockState();
-        setCurrentBlockState(currState);
-        qDebug("\n\n****highlightBlock() current state %d, prev %d", currState,
-               previousBlockState());
-
-        // temporarily disabled. See .h for reason
-        /*
-        foreach(const HighlightRule &rule, m_rules) {
-            QRegExp expression(rule.pattern);
-            int idx = expression.indexIn(text); // returns -1 when not found
-            while(idx >= 0) {
-                setFormat(idx, 1, rule.format);
-                idx = expression.indexIn(text, idx+1);
-            }
+    void BfHighlighter::recomputeDepths() {
+        m_depths.clear();   // not valid until the thread is done
+        if(m_depthWatcher.isRunning())
+            return;         // depthsComputed() will notice that the document changed
+        m_computedRevision = m_doc->revision();
+        QTextCursor all(m_doc);
+        all.select(QTextCursor::Document);
+        m_depthWatcher.setFuture(QtConcurrent::run(computeDepths, all.selectedText()));
+    }
+
+    void BfHighlighter::depthsComputed() {
+        if(m_doc->revision() != m_computedRevision) {
+            // edited while the thread was working, the result is no good
+            recomputeDepths();
+            return;
         }
-*/
+        m_depths = m_depthWatcher.result();
+        if(m_depths.size() != m_doc->blockCount() + 1) {
+            qWarning("BfHighlighter::depthsComputed() got %d depths for %d blocks",
+                     m_depths.size(), m_doc->blockCount());
+            m_depths.clear();
+            return;
+        }
+        qDebug("BfHighlighter::depthsComputed() %d lines", m_depths.size() - 1);
+        paintVisible();
+    }
 
-        /*
-         TODO: iterative version (should be easy enough).
+    void BfHighlighter::contentsChange(int position, int, int added) {
+        if(m_painting)
+            return;
 
-         I'm too used to thinking about things recursively...
-         */
-        recurHighlighter(text, currState, 0);
+        const int oldLines = m_depths.size() - 1;
+        const int lines = m_doc->blockCount();
+        if(oldLines < 0) {
+            recomputeDepths();  // the thread is still on it
+            return;
+        }
 
-    }
+        // the lines that are there now in place of the old ones first...oldLast
+        QTextBlock block = m_doc->findBlock(position);
+        QTextBlock lastBlock = m_doc->findBlock(position + added);
+        if(!lastBlock.isValid())
+            lastBlock = m_doc->lastBlock();
+        const int first = block.blockNumber();
+        const int last = lastBlock.blockNumber();
+        const int oldLast = last - (lines - oldLines);
+        if(last - first > LOCAL_UPDATE_LIMIT || oldLast < first) {
+            recomputeDepths();
+            return;
+        }
 
+        const int oldEnd = m_depths[oldLast + 1];
+        QVector<int> depths;
+        if(lines != oldLines) {
+            depths.reserve(lines + 1);
+            for(int i = 0; i <= first; ++i)
+                depths.append(m_depths[i]);
+        }
 
-    int BfHighlighter::minNotNeg(int a, int b) {
+        int depth = m_depths[first];
+        for(int n = first; n <= last; ++n, block = block.next()) {
+            depth += BfBlockData::of(block)->balance();
+            if(lines == oldLines)
+                m_depths[n + 1] = depth;
+            else
+                depths.append(depth);
+        }
 
-        int min = std::min(a,b);
-        if(min == -1) {
-            qDebug("minNotNeg() a:%d b:%d ret %d",a,b,std::max(a,b));
-            return std::max(a,b);
+        // everything after the change moves by as much as the balance changed
+        const int shift = depth - oldEnd;
+        if(lines == oldLines) {
+            if(shift != 0) {
+                for(int i = last + 2; i < m_depths.size(); ++i)
+                    m_depths[i] += shift;
+            }
+        } else {
+            for(int i = oldLast + 2; i < m_depths.size(); ++i)
+                depths.append(m_depths[i] + shift);
+            m_depths = depths;
         }
-        else {
-            qDebug("minNotNeg() a:%d b:%d ret %d",a,b,min);
-            return min;
+        if(m_depths.size() != lines + 1) {
+            recomputeDepths();  // the splice went wrong, so don't trust any of it
+            return;
         }
+
+        schedulePaint();
     }
 
-    void BfHighlighter::recurHighlighter(const QString &text, int depth, int index) {
-        QTextCharFormat temp(m_blockFormat); //make a copy of the default format
-        qDebug() << "\n---- text: " << text;
-        if(index >= text.length()) {
-            qDebug("---- bailout");
-            return;
-        }
+    void BfHighlighter::viewportUpdated(const QRect &rect, int dy) {
+        /* the cursor blinking asks for a few pixels to be updated all the time, but
+           only scrolling and resizing can bring other lines into view */
+        if(dy != 0 || rect.contains(m_editor->viewport()->rect()))
+            schedulePaint();
+    }
+
+    void BfHighlighter::schedulePaint() {
+        if(!m_paintTimer->isActive())
+            m_paintTimer->start();
+    }
+
+    void BfHighlighter::paintVisible() {
+        if(m_depths.size() != m_doc->blockCount() + 1)
+            return;     // painted when the depths are known
+
+        QTextBlock block = m_editor->cursorForPosition(QPoint(0, 0)).block();
+        const int last = m_editor->cursorForPosition(
+                QPoint(0, m_editor->viewport()->height())).block().blockNumber();
+        for(int n = block.blockNumber(); block.isValid() && n <= last;
+            ++n, block = block.next())
+            paintBlock(block, m_depths[n]);
+    }
 
-        int paintIndex;
-        paintIndex = index; // start painting from the index
-        if(text[index] == '[') {
-            depth++;
+    void BfHighlighter::paintBlock(QTextBlock block, int depth) {
+        BfBlockData *data = BfBlockData::of(block);
+        if(data->paintedRevision == data->revision && data->paintedDepth == depth)
+            return;
 
-            qDebug("---- at idx %d (%c), depth %d.", index, text[index].toAscii(),
-                   depth);
-        } else if(text[index] == ']') {
-            depth--;
-            qDebug("---- at idx %d (%c), depth %d.", index, text[index].toAscii(),
-                   depth);
-            /* close braces themselves have to be painted with the
-            previous level's color.
+        /* Each bracket changes the depth, and everything between two brackets is painted
+           with the color of the depth there. Close braces themselves have to be painted
+           with the previous level's color.
 
-            Here's a nifty diagram of what's happening:
+           Here's a nifty diagram of what's happening:
 
          01112222111111110111    Block color number
          v___vvvv________v___    Block color boundaries
          x[xx[xx]xxx][xx]x[x]
          _^^^___^^^^_^^^__^^_    Block depth change
          01112221111011100110    Block depth boundaries
-
-         0111222211111111
-         v___vvvv________
-         x[xx[xx]xxx][xx]
-         _^^^___^^^^_^^^_
-         0111222111101110
-
-
          */
-            if(depth <-1) {
-                temp.setBackground(getColorByState(depth));
+        data->paintedRevision = data->revision;
+        data->paintedDepth = depth;
+        QList<QTextLayout::FormatRange> ranges;
+        int from = 0;   // the first character that hasn't been painted
+        for(int i = 0; i < data->brackets.size(); ++i) {
+            const int idx = data->brackets[i];
+            const int pos = data->positions[idx];
+            addRange(ranges, from, pos - from, depth);
+            if(data->ops[idx] == JZ) {
+                ++depth;
+                addRange(ranges, pos, 1, depth);
             } else {
-                temp.setBackground(getColorByState(depth+1));
+                --depth;
+                // a ] without a [ stays in the "too many ]s" color
+                addRange(ranges, pos, 1, depth < -1 ? depth : depth+1);
             }
-            setFormat(index, 1, temp);
-            // with close braces the painting has to start from one step after the index
-            paintIndex = index+1;
+            from = pos + 1;
         }
+        addRange(ranges, from, block.length() - 1 - from, depth);
 
-        setCurrentBlockState(depth);
-
-
-        int closestStart = text.indexOf(m_startBlockExp, index+1);
-        int closestEnd = text.indexOf(m_endBlockExp, index+1);
-        int closest = minNotNeg(closestStart, closestEnd);
-
-        if(closest == -1) {
-            // no new braces on this line. Paint to the end of the line
-            closest = text.length();
-        }
+        m_painting = true;
+        block.layout()->setAdditionalFormats(ranges);
+        m_doc->markContentsDirty(block.position(), block.length());
+        m_painting = false;
+    }
 
-        temp.setBackground(getColorByState(depth));
-        qDebug("----  Painting %d, closest %d\n", (closest-index), closest);
-        qDebug("---- block state %d, depth %d",currentBlockState(), depth);
-        qDebug() << "---- color" << getColorByState(depth);
-        setFormat(paintIndex,(closest-index), temp);
-        recurHighlighter(text,depth,closest);
+    void BfHighlighter::addRange(QList<QTextLayout::FormatRange> &ranges, int start,
+                                 int count, int depth) {
+        if(count <= 0)
+            return;
+        QTextLayout::FormatRange range;
+        range.start = start;
+        range.length = count;
+        range.format = m_blockFormat;
+        range.format.setBackground(getColorByState(depth));
+        ranges.append(range);
     }
 
     inline QColor BfHighlighter::getColorByState(int state) {
@@ -24,23 +24,81 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef BFHIGHLIGHTER_H
 #define BFHIGHLIGHTER_H
 
-#include <QSyntaxHighlighter>
+#include <QObject>
+#include <QColor>
+#include <QTextCharFormat>
+#include <QTextLayout>
+#include <QVector>
+#include <QFutureWatcher>
+
+class QPlainTextEdit;
+class QTextDocument;
+class QTextBlock;
+class QTimer;
+class QRect;
+
 namespace QtBrain {
-    class BfHighlighter : public QSyntaxHighlighter
+
+    /**
+      Paints the background of each [ ] block with a color that depends on how deeply
+      it's nested.
+
+      Unlike QSyntaxHighlighter, which formats the whole document as soon as it's loaded,
+      this only ever formats the lines that are visible in the editor, when they become
+      visible. Knowing the color of a line requires knowing how deep it starts, so the
+      depth at the start of every line is kept in m_depths:
+
+      - When a document is loaded (or a large part of it changes at once) the depths are
+        computed from a copy of the text in a background thread, and the editor stays
+        responsive meanwhile.
+      - After a small edit only the changed lines are looked at. Their brackets come from
+        their BfBlockData, which the compiler uses too, and the lines after them just
+        move up or down by the change in balance.
+
+      A line is painted again only if its text or the depth it starts at has changed
+      since it was last painted.
+      */
+    class BfHighlighter : public QObject
     {
         Q_OBJECT
     public:
-        BfHighlighter(QTextDocument *parent = 0);
+        BfHighlighter(QPlainTextEdit *editor);
+
+        static const int LOCAL_UPDATE_LIMIT = 1000; /* edits that touch more lines than
+                                                       this are handed over to the
+                                                       background thread */
+
+    protected slots:
+        void contentsChange(int position, int removed, int added);
+        void depthsComputed();              // the background thread is done
+        void viewportUpdated(const QRect &rect, int dy);
+                                            // schedules a paint if it has scrolled
+        void schedulePaint();               // paints the visible lines soon
+        void paintVisible();
+
     protected:
-        void highlightBlock(const QString &text);
+        QPlainTextEdit          *m_editor;
+        QTextDocument           *m_doc;
+        QTimer                  *m_paintTimer;
+
+        QVector<int>            m_depths;   /* the depth at the start of each line, and
+                                               at the end of the last one. -1 is outside
+                                               of all loops. Only valid when there is one
+                                               entry more than there are lines */
+        QFutureWatcher<QVector<int> > m_depthWatcher;
+        int                     m_computedRevision; /* document revision the background
+                                                       thread is working on */
+        bool                    m_painting; // set while formats are being applied
 
-        /* uses recursion to highlight [] blocks in the source. See the .cpp for
-           explanations.
-           Basically it paints from the given position index to the next [ or ] character,
-           using a color dependent on the depth of the current [] block.
-        */
-        void recurHighlighter(const QString&, int depth, const int index);
+        // starts computing the depths in the background
+        void recomputeDepths();
 
+        // paints the block if it has changed since the last time
+        void paintBlock(QTextBlock block, int depth);
+
+        // adds a range of count characters in the color of the given depth
+        void addRange(QList<QTextLayout::FormatRange> &ranges, int start, int count,
+                      int depth);
 
     private:
         // The base color of the [ ] blocks.
@@ -65,17 +123,11 @@ namespace QtBrain {
         QTextCharFormat m_jmpFormat;
 */
 
-        QRegExp m_startBlockExp;
-        QRegExp m_endBlockExp;
         QTextCharFormat m_blockFormat;
 
         // convenience funtion to return a proper QColor depending on QTextBlock state
         QColor getColorByState(int state);
 
-        /* returns the smallest of the two, unless one is negative in which case
-           the nonnegative one is returned. If both are negative, -1 is returned */
-        int minNotNeg(int a, int b);
-
     };
 }
 #endif // BFHIGHLIGHTER_H
@@ -0,0 +1,167 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bflexer.h"
+#include <QChar>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace QtBrain {
+
+#define X INVALID
+    const BfOpcode BfLexer::OPCODES[256] = {
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x00
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x10
+        X, X, X, X, X, BRK, X, X, X, X, X, ADD, INP, SUB, OUT, X,  // 0x20
+        X, X, X, X, X, X, X, X, X, X, X, X, DPDEC, X, DPINC, X,  // 0x30
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x40
+        X, X, X, X, X, X, X, X, X, X, X, JZ, X, JNZ, X, X,  // 0x50
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x60
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x70
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x80
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0x90
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0xA0
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0xB0
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0xC0
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0xD0
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 0xE0
+        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X   // 0xF0
+    };
+#undef X
+
+    namespace {
+        // how much is scanned before the output vectors are trimmed back
+        const int SCAN_BLOCK = 1 << 16;
+
+        // index of the lowest set bit. mask can't be 0
+        inline int lowestBit(unsigned int mask) {
+#if defined(Q_CC_GNU)
+            return __builtin_ctz(mask);
+#else
+            int bit = 0;
+            while(!(mask & 1)) {
+                mask >>= 1;
+                ++bit;
+            }
+            return bit;
+#endif
+        }
+
+#ifdef __SSE2__
+        /* sets the bytes of v that are commands to 0xff. The commands are +,-. (a range),
+           < and > (which differ by one bit), [ and ], and % */
+        inline int commandMask(__m128i v) {
+            const __m128i fromPlus = _mm_sub_epi8(v, _mm_set1_epi8('+'));
+            __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(fromPlus, _mm_set1_epi8(3)), fromPlus);
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(2)),
+                                               _mm_set1_epi8('>')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('%')));
+            return _mm_movemask_epi8(m);
+        }
+#endif
+
+        template <typename Char>
+        inline uchar narrow(Char c);
+        template <> inline uchar narrow(char c) { return uchar(c); }
+        template <> inline uchar narrow(QChar c) {
+            // anything outside Latin-1 becomes something that isn't a command
+            return c.unicode() < 0x100 ? uchar(c.unicode()) : 0;
+        }
+
+#ifdef __SSE2__
+        template <typename Char> inline __m128i load16(const Char *p);
+        template <> inline __m128i load16(const char *p) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        }
+        template <> inline __m128i load16(const QChar *p) {
+            /* packus saturates 0x100-0x7fff to 0xff and, since it takes the values as
+               signed, 0x8000-0xffff to 0. Neither is a command */
+            const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+            return _mm_packus_epi16(lo, hi);
+        }
+#endif
+
+        /* the actual scanner. Char is a byte or a QChar, and the SSE2 version looks at 16
+           of them at a time */
+        template <typename Char>
+        int scanBlock(const Char *data, int len, quint32 offset, BfOpcode *ops,
+                      quint32 *positions, const BfOpcode *table) {
+            int count = 0;
+            int i = 0;
+#ifdef __SSE2__
+            for(; i + 16 <= len; i += 16) {
+                int mask = commandMask(load16(data + i));
+                // mostly comments, so mostly nothing to do
+                while(mask != 0) {
+                    const int bit = lowestBit(mask);
+                    ops[count] = table[narrow(data[i + bit])];
+                    positions[count] = offset + i + bit;
+                    ++count;
+                    mask &= mask - 1;
+                }
+            }
+#endif
+            for(; i < len; ++i) {
+                const BfOpcode op = table[narrow(data[i])];
+                if(op != INVALID) {
+                    ops[count] = op;
+                    positions[count] = offset + i;
+                    ++count;
+                }
+            }
+            return count;
+        }
+
+        template <typename Char>
+        void scanAll(const Char *data, int len, quint32 offset, QVector<BfOpcode> &ops,
+                     QVector<quint32> &positions, const BfOpcode *table) {
+            /* make room for the worst case of a block, write straight into the vectors and
+               cut them back to what was found */
+            for(int start = 0; start < len; start += SCAN_BLOCK) {
+                const int blockLen = qMin(SCAN_BLOCK, len - start);
+                const int size = ops.size();
+                ops.resize(size + blockLen);
+                positions.resize(size + blockLen);
+                const int found = scanBlock(data + start, blockLen, offset + start,
+                                            ops.data() + size, positions.data() + size,
+                                            table);
+                ops.resize(size + found);
+                positions.resize(size + found);
+            }
+        }
+    }
+
+    void BfLexer::scan(const char *data, int len, quint32 offset, QVector<BfOpcode> &ops,
+                       QVector<quint32> &positions) {
+        scanAll(data, len, offset, ops, positions, OPCODES);
+    }
+
+    void BfLexer::scan(const QChar *data, int len, quint32 offset, QVector<BfOpcode> &ops,
+                       QVector<quint32> &positions) {
+        scanAll(data, len, offset, ops, positions, OPCODES);
+    }
+}
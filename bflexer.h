@@ -0,0 +1,62 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFLEXER_H
+#define BFLEXER_H
+
+#include "bfvm.h"
+#include <QVector>
+
+class QChar;
+
+namespace QtBrain {
+
+    /**
+      Finds the Brainfuck commands in source code.
+
+      Most of a typical source is comments, so the lexer looks at 16 bytes at a time with
+      SSE2: all of them are compared to the command characters at once, and only the ones
+      that matched are looked at one by one. Without SSE2 every byte goes through a
+      lookup table.
+
+      QStrings are narrowed to bytes on the fly. Characters outside Latin-1 can't be
+      commands anyway.
+      */
+    class BfLexer
+    {
+    public:
+        // the opcode for c, or INVALID if it isn't a command
+        static BfOpcode opcode(char c) { return OPCODES[uchar(c)]; }
+
+        /* appends the commands in data to ops and the position of each (offset + index
+           in data) to positions */
+        static void scan(const char *data, int len, quint32 offset,
+                         QVector<BfOpcode> &ops, QVector<quint32> &positions);
+        static void scan(const QChar *data, int len, quint32 offset,
+                         QVector<BfOpcode> &ops, QVector<quint32> &positions);
+
+    private:
+        static const BfOpcode OPCODES[256];
+    };
+}
+#endif // BFLEXER_H
@@ -0,0 +1,184 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfmemorymodel.h"
+#include <cmath>
+
+namespace QtBrain {
+
+    BfMemoryModel::BfMemoryModel(QObject *parent) :
+            QAbstractTableModel(parent),
+            m_cells(NULL),
+            m_size(0),
+            m_dp(0),
+            m_hex(false),
+            m_maxAccesses(0)
+    {
+    }
+
+    void BfMemoryModel::setTape(const Memtype *cells, int size) {
+        beginResetModel();
+        m_cells = cells;
+        m_size = cells != NULL ? size : 0;
+        endResetModel();
+    }
+
+    int BfMemoryModel::rowCount(const QModelIndex &parent) const {
+        if(parent.isValid())
+            return 0;
+        return (m_size + CELLS_PER_ROW - 1) / CELLS_PER_ROW;
+    }
+
+    int BfMemoryModel::columnCount(const QModelIndex &parent) const {
+        return parent.isValid() ? 0 : CELLS_PER_ROW + 1;
+    }
+
+    QModelIndex BfMemoryModel::indexOf(DPType address) const {
+        return index(address / CELLS_PER_ROW, address % CELLS_PER_ROW);
+    }
+
+    QString BfMemoryModel::cellText(Memtype cell) const {
+        if(m_hex)
+            return QString::fromLatin1("%1").arg(quint8(cell), 2, 16, QLatin1Char('0'));
+        return QString::number(cell);
+    }
+
+    QVariant BfMemoryModel::data(const QModelIndex &index, int role) const {
+        if(!index.isValid())
+            return QVariant();
+        const int first = index.row() * CELLS_PER_ROW;
+
+        if(index.column() == TEXT_COLUMN) {
+            if(role != Qt::DisplayRole)
+                return QVariant();
+            // everything that isn't printable ASCII is a dot
+            QString text;
+            for(int a = first; a < first + CELLS_PER_ROW && a < m_size; ++a) {
+                const uchar c = uchar(m_cells[a]);
+                text.append(c >= 32 && c < 127 ? QLatin1Char(c) : QLatin1Char('.'));
+            }
+            return text;
+        }
+
+        const int address = first + index.column();
+        if(address >= m_size)
+            return QVariant();
+        switch(role) {
+        case Qt::DisplayRole:
+            return cellText(m_cells[address]);
+        case Qt::ToolTipRole: {
+            QString tip = tr("Cell %1: %2 (0x%3)").arg(address).arg(m_cells[address])
+                          .arg(quint8(m_cells[address]), 2, 16, QLatin1Char('0'));
+            if(address < m_profile.reads.size()) {
+                tip += tr("\n%1 reads, %2 writes").arg(m_profile.reads[address])
+                       .arg(m_profile.writes[address]);
+            }
+            return tip;
+        }
+        case Qt::TextAlignmentRole:
+            return int(Qt::AlignCenter);
+        case Qt::BackgroundRole:
+            if(address == m_dp)
+                return QColor(Qt::yellow);
+            return heatColor(address);
+        default:
+            return QVariant();
+        }
+    }
+
+    QColor BfMemoryModel::heatColor(int address) const {
+        if(m_maxAccesses == 0 || address >= m_profile.reads.size())
+            return QColor();
+        const quint64 accesses = m_profile.reads[address] + m_profile.writes[address];
+        if(accesses == 0)
+            return QColor();
+        // from a pale orange for a single access to red for the hottest cell
+        const double heat = std::log(double(accesses) + 1) /
+                            std::log(double(m_maxAccesses) + 1);
+        return QColor::fromHsvF(0.08 * (1 - heat), 0.15 + 0.75 * heat, 1.0);
+    }
+
+    QVariant BfMemoryModel::headerData(int section, Qt::Orientation orientation,
+                                       int role) const {
+        if(role != Qt::DisplayRole)
+            return QVariant();
+        if(orientation == Qt::Horizontal) {
+            if(section == TEXT_COLUMN)
+                return tr("Text");
+            return QString::fromLatin1("+%1").arg(section);
+        }
+        // the address of the first cell on the row
+        const int address = section * CELLS_PER_ROW;
+        if(m_hex)
+            return QString::fromLatin1("%1").arg(address, 4, 16, QLatin1Char('0'));
+        return QString::number(address);
+    }
+
+    void BfMemoryModel::cellsChanged(DPType first, DPType last) {
+        if(first > last || int(first) >= m_size)
+            return;
+        const int lastRow = qMin(int(last), m_size - 1) / CELLS_PER_ROW;
+        emit dataChanged(index(first / CELLS_PER_ROW, 0), index(lastRow, TEXT_COLUMN));
+    }
+
+    void BfMemoryModel::allCellsChanged() {
+        if(m_size > 0)
+            emit dataChanged(index(0, 0), index(rowCount() - 1, TEXT_COLUMN));
+    }
+
+    void BfMemoryModel::setDp(DPType dp) {
+        if(dp == m_dp)
+            return;
+        const DPType old = m_dp;
+        m_dp = dp;
+        if(int(old) < m_size)
+            emit dataChanged(indexOf(old), indexOf(old));
+        if(int(dp) < m_size)
+            emit dataChanged(indexOf(dp), indexOf(dp));
+    }
+
+    void BfMemoryModel::setHexadecimal(bool hex) {
+        if(hex == m_hex)
+            return;
+        m_hex = hex;
+        allCellsChanged();
+        emit headerDataChanged(Qt::Vertical, 0, rowCount() - 1);
+    }
+
+    void BfMemoryModel::setProfile(const BfMemoryProfile &profile) {
+        m_profile = profile;
+        m_maxAccesses = 0;
+        for(int i = 0; i < m_profile.reads.size(); ++i) {
+            m_maxAccesses = qMax(m_maxAccesses, m_profile.reads[i] + m_profile.writes[i]);
+        }
+        allCellsChanged();
+    }
+
+    void BfMemoryModel::clearProfile() {
+        if(m_profile.reads.isEmpty())
+            return;
+        m_profile = BfMemoryProfile();
+        m_maxAccesses = 0;
+        allCellsChanged();
+    }
+}
@@ -0,0 +1,87 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFMEMORYMODEL_H
+#define BFMEMORYMODEL_H
+
+#include "bfvm.h"
+#include <QAbstractTableModel>
+#include <QColor>
+
+namespace QtBrain {
+
+    /**
+      The VM's whole tape as a table, CELLS_PER_ROW cells per row with the cells as text
+      in the last column, like a hex dump.
+
+      The model doesn't keep a copy of the tape, it just reads the cells it's pointed at
+      when a view asks for them, and views only ask for the rows they show. After the
+      cells change, cellsChanged() tells the views which rows to fetch again, so a step
+      costs nothing for the rows that aren't visible or didn't change.
+
+      Given a memory profile, the cells are shaded by how often they were accessed, on a
+      log scale since a handful of cells usually get nearly all of the accesses.
+      */
+    class BfMemoryModel : public QAbstractTableModel
+    {
+        Q_OBJECT
+    public:
+        BfMemoryModel(QObject *parent = 0);
+
+        // the cells to show. They're not copied and must stay around
+        void setTape(const Memtype *cells, int size);
+
+        int rowCount(const QModelIndex &parent = QModelIndex()) const;
+        int columnCount(const QModelIndex &parent = QModelIndex()) const;
+        QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+        QVariant headerData(int section, Qt::Orientation orientation,
+                            int role = Qt::DisplayRole) const;
+
+        QModelIndex indexOf(DPType address) const;  // the index of a cell
+        DPType dp() const { return m_dp; }
+        bool isHexadecimal() const { return m_hex; }
+
+        static const int CELLS_PER_ROW = 8;
+        static const int TEXT_COLUMN = CELLS_PER_ROW;
+
+    public slots:
+        void cellsChanged(DPType first, DPType last);   // inclusive
+        void allCellsChanged();
+        void setDp(DPType dp);                          // the DP's cell is highlighted
+        void setHexadecimal(bool hex);                  // decimal by default
+        void setProfile(const BfMemoryProfile &profile);// shows the heatmap
+        void clearProfile();
+
+    protected:
+        const Memtype   *m_cells;
+        int             m_size;     // number of cells
+        DPType          m_dp;
+        bool            m_hex;
+        BfMemoryProfile m_profile;
+        quint64         m_maxAccesses;  // of any single cell in m_profile
+
+        QString cellText(Memtype cell) const;
+        QColor heatColor(int address) const;    // invalid if the cell is cold
+    };
+}
+#endif // BFMEMORYMODEL_H
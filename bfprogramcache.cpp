@@ -0,0 +1,332 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfprogramcache.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QDateTime>
+#include <QDir>
+#include <QStringList>
+#include <QCryptographicHash>
+#include <QDesktopServices>
+#include <QVector>
+#include <QPair>
+#include <QBitArray>
+#include <QDebug>
+#include <cstring>
+
+namespace QtBrain {
+
+    namespace {
+        /* the start of every .bfc file. The sections follow in the order of their offsets,
+           which are from the start of the file */
+        struct Header {
+            quint32 magic;
+            quint32 version;
+            char    sourceHash[20];     // SHA-1
+            quint32 instructions;       // in the bytecode and the mappings
+            quint32 jumps;              // (JZ, JNZ) pairs
+            quint32 reserved;           // keeps the offsets aligned
+            quint64 bytecodeOffset;
+            quint64 jumpsOffset;
+            quint64 mappingsOffset;
+        };
+
+        // the contents of a .src file, see BfProgramCache::lookup()
+        struct SourceKey {
+            quint32 magic;
+            quint32 version;
+            qint64  size;               // of the source file...
+            qint64  modified;           // ...and its modification time, in seconds
+            char    sourceHash[20];     // SHA-1 of what was in it
+            quint32 reserved;
+        };
+
+        // the quint32 sections start at multiples of 8
+        quint64 align(quint64 offset) {
+            return (offset + 7) & ~quint64(7);
+        }
+
+        /* collects small writes into large ones */
+        class ChunkWriter {
+        public:
+            ChunkWriter(QFile *file, int chunkSize) :
+                    m_file(file), m_chunk(chunkSize, '\0'), m_used(0), m_ok(true) {}
+            void write(const void *data, int len) {
+                if(m_used + len > m_chunk.size())
+                    flush();
+                memcpy(m_chunk.data() + m_used, data, len);
+                m_used += len;
+            }
+            void padTo(quint64 offset) {
+                static const char zeros[8] = {0};
+                const quint64 pos = quint64(m_file->pos()) + m_used;
+                if(pos < offset)
+                    write(zeros, int(offset - pos));
+            }
+            bool flush() {
+                if(m_used > 0 && m_file->write(m_chunk.constData(), m_used) != m_used)
+                    m_ok = false;
+                m_used = 0;
+                return m_ok;
+            }
+        private:
+            QFile       *m_file;
+            QByteArray  m_chunk;
+            int         m_used;     // how much of m_chunk is filled
+            bool        m_ok;
+        };
+    }
+
+
+    BfProgramCache::BfProgramCache(const QString &directory) :
+            m_directory(directory)
+    {
+    }
+
+    QString BfProgramCache::defaultDirectory() {
+        return QDesktopServices::storageLocation(QDesktopServices::CacheLocation)
+                + QLatin1String("/programs");
+    }
+
+    QByteArray BfProgramCache::lookup(const QFileInfo &source) const {
+        if(!isEnabled())
+            return QByteArray();
+
+        QFile file(keyName(source));
+        SourceKey key;
+        if(!file.open(QIODevice::ReadOnly)
+           || file.read(reinterpret_cast<char*>(&key), sizeof(SourceKey))
+                != qint64(sizeof(SourceKey)))
+            return QByteArray();
+
+        if(key.magic != MAGIC || key.version != VERSION || key.size != source.size()
+           || key.modified != qint64(source.lastModified().toTime_t()))
+            return QByteArray();
+        return QByteArray(key.sourceHash, sizeof(key.sourceHash));
+    }
+
+    void BfProgramCache::remember(const QFileInfo &source, const QByteArray &hash) const {
+        const QDateTime modified = source.lastModified();
+        if(!isEnabled() || hash.size() != int(sizeof(SourceKey().sourceHash))
+           || modified.secsTo(QDateTime::currentDateTime()) < 2
+           || !QDir().mkpath(m_directory))
+            return;
+
+        SourceKey key;
+        memset(&key, 0, sizeof(SourceKey));
+        key.magic = MAGIC;
+        key.version = VERSION;
+        key.size = source.size();
+        key.modified = modified.toTime_t();
+        memcpy(key.sourceHash, hash.constData(), sizeof(key.sourceHash));
+
+        QTemporaryFile file(temporaryTemplate());
+        if(!file.open()
+           || file.write(reinterpret_cast<const char*>(&key), sizeof(SourceKey))
+                != qint64(sizeof(SourceKey)))
+            return;
+        commit(file, keyName(source));
+    }
+
+    QString BfProgramCache::fileName(const QByteArray &hash) const {
+        return m_directory + QLatin1Char('/') + QString::fromLatin1(hash.toHex())
+                + QLatin1String(".bfc");
+    }
+
+    QString BfProgramCache::keyName(const QFileInfo &source) const {
+        const QByteArray path = source.absoluteFilePath().toUtf8();
+        return m_directory + QLatin1Char('/')
+                + QString::fromLatin1(QCryptographicHash::hash(path,
+                                          QCryptographicHash::Sha1).toHex())
+                + QLatin1String(".src");
+    }
+
+    QString BfProgramCache::temporaryTemplate() const {
+        return m_directory + QLatin1String("/XXXXXX.tmp");
+    }
+
+    bool BfProgramCache::commit(QTemporaryFile &file, const QString &name) {
+        file.close();
+        if(file.error() != QFile::NoError)
+            return false;
+        // another process may have stored the same thing meanwhile, which is just as good
+        QFile::remove(name);
+        if(!file.rename(name))
+            return false;   // the temporary file is removed when it goes away
+        file.setAutoRemove(false);
+        return true;
+    }
+
+    void BfProgramCache::prune() const {
+        const QStringList filters = QStringList() << QLatin1String("*.bfc")
+                                                  << QLatin1String("*.src");
+        // newest first
+        const QFileInfoList files = QDir(m_directory).entryInfoList(filters, QDir::Files,
+                                                                    QDir::Time);
+        qint64 total = 0;
+        for(int i = 0; i < files.size(); ++i) {
+            total += files[i].size();
+            if(i > 0 && total > MAX_SIZE) {
+                qDebug("BfProgramCache::prune() removing %s",
+                       qPrintable(files[i].fileName()));
+                QFile::remove(files[i].absoluteFilePath());
+            }
+        }
+    }
+
+    bool BfProgramCache::load(const QByteArray &hash, QList<BfOpcode> &bytecode,
+                              BiHash<IPType,IPType> &jmps, BfSourceMap &mappings) const {
+        if(!isEnabled() || hash.size() != int(sizeof(Header().sourceHash)))
+            return false;
+
+        QFile file(fileName(hash));
+        if(!file.open(QIODevice::ReadOnly))
+            return false;
+        const qint64 size = file.size();
+        if(size < qint64(sizeof(Header)))
+            return false;
+        const uchar *data = file.map(0, size);
+        if(data == NULL) {
+            qDebug("BfProgramCache::load() can't map %s", qPrintable(file.fileName()));
+            return false;
+        }
+
+        // the header has to describe a file of exactly this size
+        Header header;
+        memcpy(&header, data, sizeof(Header));
+        const quint64 bytecodeEnd = header.bytecodeOffset + header.instructions;
+        const quint64 jumpsEnd = header.jumpsOffset + quint64(header.jumps) * 8;
+        const quint64 mappingsEnd = header.mappingsOffset + quint64(header.instructions) * 4;
+        if(header.magic != MAGIC || header.version != VERSION
+           || memcmp(header.sourceHash, hash.constData(), sizeof(header.sourceHash)) != 0
+           || header.bytecodeOffset != sizeof(Header)
+           || header.jumpsOffset != align(bytecodeEnd)
+           || header.mappingsOffset != jumpsEnd
+           || mappingsEnd != quint64(size)) {
+            qDebug("BfProgramCache::load() %s is not a usable program",
+                   qPrintable(file.fileName()));
+            return false;
+        }
+
+        /* compiled() hands out Qt containers, which can't wrap the mapping, so each
+           section is copied out of it as is */
+        const uchar *ops = data + header.bytecodeOffset;
+        bytecode.clear();
+        bytecode.reserve(header.instructions);
+        quint64 brackets = 0;
+        for(quint32 i = 0; i < header.instructions; ++i) {
+            if(ops[i] >= INVALID)
+                return false;
+            if(ops[i] == JZ || ops[i] == JNZ)
+                ++brackets;
+            bytecode.append(BfOpcode(ops[i]));
+        }
+
+        /* the VM follows the jumps without looking, so each one has to go from a [ to a
+           later ], and every bracket has to be in exactly one pair. BiHash::build() only
+           asserts that */
+        if(brackets != quint64(header.jumps) * 2)
+            return false;
+        const quint32 *jumps = reinterpret_cast<const quint32*>(data + header.jumpsOffset);
+        QVector<QPair<IPType,IPType> > pairs(header.jumps);
+        QBitArray paired(header.instructions);
+        for(quint32 i = 0; i < header.jumps; ++i) {
+            const quint32 jz = jumps[2*i];
+            const quint32 jnz = jumps[2*i+1];
+            if(jz >= jnz || jnz >= header.instructions || ops[jz] != JZ || ops[jnz] != JNZ
+               || paired.testBit(jz) || paired.testBit(jnz)) {
+                qDebug("BfProgramCache::load() bad jump %u -> %u in %s", jz, jnz,
+                       qPrintable(file.fileName()));
+                return false;
+            }
+            paired.setBit(jz);
+            paired.setBit(jnz);
+            pairs[i] = qMakePair(jz, jnz);
+        }
+        jmps.build(pairs);
+
+        mappings.clear();
+        mappings.append(reinterpret_cast<const quint32*>(data + header.mappingsOffset),
+                        header.instructions);
+
+        qDebug("BfProgramCache::load() %u instructions from %s", header.instructions,
+               qPrintable(file.fileName()));
+        return true;
+    }
+
+    bool BfProgramCache::store(const QByteArray &hash, const QList<BfOpcode> &bytecode,
+                               const BiHash<IPType,IPType> &jmps,
+                               const BfSourceMap &mappings) const {
+        if(!isEnabled() || hash.size() != int(sizeof(Header().sourceHash))
+           || !QDir().mkpath(m_directory))
+            return false;
+
+        Header header;
+        memset(&header, 0, sizeof(Header));
+        header.magic = MAGIC;
+        header.version = VERSION;
+        memcpy(header.sourceHash, hash.constData(), sizeof(header.sourceHash));
+        header.instructions = bytecode.size();
+        header.jumps = jmps.size();
+        header.bytecodeOffset = sizeof(Header);
+        header.jumpsOffset = align(header.bytecodeOffset + header.instructions);
+        header.mappingsOffset = header.jumpsOffset + quint64(header.jumps) * 8;
+
+        /* write to a temporary file first, so that a half written program is never
+           mistaken for a whole one. Other processes get temporary files of their own */
+        const QString name = fileName(hash);
+        QTemporaryFile file(temporaryTemplate());
+        if(!file.open())
+            return false;
+
+        ChunkWriter out(&file, IO_CHUNK);
+        out.write(&header, sizeof(Header));
+        for(int i = 0; i < bytecode.size(); ++i) {
+            const uchar op = uchar(bytecode.at(i));
+            out.write(&op, 1);
+        }
+        out.padTo(header.jumpsOffset);
+        for(BiHash<IPType,IPType>::const_iterator it = jmps.constBegin();
+            it != jmps.constEnd(); ++it) {
+            const quint32 pair[2] = {it.key(), it.value()};
+            out.write(pair, sizeof(pair));
+        }
+
+        // the mappings may be compressed, so they're decoded a chunk at a time
+        QVector<quint32> positions(IO_CHUNK / 4);
+        for(int ip = 0; ip < mappings.size(); ip += positions.size()) {
+            const int count = qMin(positions.size(), mappings.size() - ip);
+            mappings.copy(ip, count, positions.data());
+            out.write(positions.constData(), count * 4);
+        }
+
+        if(!out.flush() || !commit(file, name))
+            return false;
+        qDebug("BfProgramCache::store() %u instructions to %s", header.instructions,
+               qPrintable(name));
+        prune();
+        return true;
+    }
+}
@@ -0,0 +1,134 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFPROGRAMCACHE_H
+#define BFPROGRAMCACHE_H
+
+#include "bfvm.h"
+#include "bfsourcemap.h"
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+class QFileInfo;
+class QTemporaryFile;
+
+namespace QtBrain {
+
+    /**
+      Keeps compiled programs on disk so that an unchanged source never has to be compiled
+      again. The programs are stored by the SHA-1 of their source, so it doesn't matter
+      where the source is or what it's called.
+
+      Each program is a .bfc file laid out so that it can be mapped and used straight
+      away, without parsing anything:
+
+          header      magic, format version, source hash, counts and section offsets
+          bytecode    one byte per instruction
+          jumps       (JZ, JNZ) pairs of quint32s
+          mappings    the source position of each instruction as a quint32
+
+      Everything is in the byte order of the machine that wrote it; files from another
+      kind of machine simply fail the magic check. VERSION has to be bumped whenever the
+      layout or the meaning of the bytecode changes.
+
+      Finding a program by its hash would mean reading the whole source just to find out
+      whether it has to be read again for compiling. So for every source file, a small
+      .src file named after its path records the size and modification time the file
+      had when it was compiled, and the hash of what was in it. If those still match,
+      lookup() gives the hash without reading anything, and otherwise the compiler
+      hashes the source while compiling it and records it with remember().
+
+      Files are written under a temporary name and renamed into place, so a program is
+      never seen half written, even with several processes using the same cache. After
+      each program is stored, the oldest files are removed until the cache fits in
+      MAX_SIZE.
+
+      The cache is only an optimization, so nothing is reported if a program can't be
+      stored or loaded: the caller just compiles the source as if the cache wasn't there.
+      */
+    class BfProgramCache
+    {
+    public:
+        explicit BfProgramCache(const QString &directory = defaultDirectory());
+
+        // the platform's cache directory for the application
+        static QString defaultDirectory();
+
+        /* where the programs are stored. An empty directory disables the cache, which
+           makes load() and store() always fail */
+        void setDirectory(const QString &directory) { m_directory = directory; }
+        QString directory() const { return m_directory; }
+        bool isEnabled() const { return !m_directory.isEmpty(); }
+
+        /**
+          Returns the hash remember() recorded for the source file, or an empty array if
+          there is none or the file has changed since.
+          */
+        QByteArray lookup(const QFileInfo &source) const;
+
+        /**
+          Records that the source file, as it is now, has the given SHA-1. Files changed
+          in the last couple of seconds aren't recorded: a change within the same second
+          wouldn't show in the modification time.
+          */
+        void remember(const QFileInfo &source, const QByteArray &hash) const;
+
+        /**
+          Loads the program compiled from the source with the given hash. Returns false
+          if there is no such program in the cache or it can't be used, in which case the
+          arguments are left in an undefined state.
+          */
+        bool load(const QByteArray &hash, QList<BfOpcode> &bytecode,
+                  BiHash<IPType,IPType> &jmps, BfSourceMap &mappings) const;
+
+        /**
+          Stores a program compiled from the source with the given hash, replacing any
+          earlier one, and prunes the cache. Returns false if it couldn't be written.
+          */
+        bool store(const QByteArray &hash, const QList<BfOpcode> &bytecode,
+                   const BiHash<IPType,IPType> &jmps, const BfSourceMap &mappings) const;
+
+        static const quint32 MAGIC = 0x43464251;    // "QBFC" in little-endian
+        static const quint32 VERSION = 1;
+        static const int IO_CHUNK = 1 << 20;        /* how much is read or written at once
+                                                       when not mapping */
+        static const qint64 MAX_SIZE = 256 << 20;   /* how large the cache may grow. The
+                                                       newest program is always kept */
+
+    protected:
+        QString fileName(const QByteArray &hash) const;  // where the program is stored
+        QString keyName(const QFileInfo &source) const; // where lookup() looks
+
+        // the QTemporaryFile template for files being written, see commit()
+        QString temporaryTemplate() const;
+
+        // closes the temporary file and renames it to name. Returns false on errors
+        static bool commit(QTemporaryFile &file, const QString &name);
+
+        void prune() const;                 // removes the oldest files above MAX_SIZE
+
+        QString m_directory;
+    };
+}
+#endif // BFPROGRAMCACHE_H
@@ -0,0 +1,239 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfrunner.h"
+#include "bfcompiler.h"
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QDebug>
+#include <cstdio>
+
+namespace QtBrain {
+
+    BfRunner::BfRunner(QObject *parent) :
+            QObject(parent),
+            m_vm(new BfVM()),
+            m_compiler(new BfCompiler(this)),
+            m_eofBehaviour(EOF_UNCHANGED),
+            m_started(false)
+    {
+        m_vm->start();
+        m_compiler->start();
+
+        connect(this, SIGNAL(compileFile(const QString&)), m_compiler,
+                SLOT(compileFile(const QString&)));
+        connect(m_compiler, SIGNAL(compiled(QList<BfOpcode>,
+                                            BiHash<IPType,IPType>&,
+                                            BfSourceMap&)),
+                this, SLOT(compiled(QList<BfOpcode>,
+                                    BiHash<IPType,IPType>&,
+                                    BfSourceMap&)));
+        connect(m_compiler, SIGNAL(error(const QString&,quint32)), this,
+                SLOT(compilerError(const QString&,quint32)));
+
+        connect(this, SIGNAL(initialize(const QList<BfOpcode>&)), m_vm,
+                SLOT(initialize(const QList<BfOpcode>&)));
+        connect(this, SIGNAL(changeDelay(int)), m_vm, SLOT(changeDelay(int)));
+        connect(this, SIGNAL(changeEofBehaviour(BfEofBehaviour)), m_vm,
+                SLOT(setEofBehaviour(BfEofBehaviour)));
+        connect(this, SIGNAL(changeMemoryProfiling(bool)), m_vm,
+                SLOT(setMemoryProfiling(bool)));
+        connect(this, SIGNAL(toggleRun()), m_vm, SIGNAL(toggleRunSig()));
+
+        connect(m_vm, SIGNAL(inited()), this, SLOT(vmInited()));
+        /* needInput() only means the program is waiting for stdin, which may well have
+           something later on. Only give up when there's nothing more to wait for */
+        connect(m_vm, SIGNAL(inputExhausted()), this, SLOT(vmInputExhausted()));
+        connect(m_vm, SIGNAL(finish()), this, SLOT(vmFinished()));
+        connect(m_vm, SIGNAL(memoryProfile(const BfMemoryProfile&)), this,
+                SLOT(vmMemoryProfile(const BfMemoryProfile&)));
+    }
+
+    BfRunner::~BfRunner() {
+        qDebug("~BfRunner()");
+        m_vm->quit();
+        m_vm->wait();
+        delete m_vm;
+    }
+
+    void BfRunner::setSourceFile(const QString &fileName) {
+        m_sourceFile = fileName;
+    }
+
+    void BfRunner::setMetricsFile(const QString &fileName) {
+        m_metricsFile = fileName;
+    }
+
+    void BfRunner::setMemoryProfileFile(const QString &fileName) {
+        m_memoryProfileFile = fileName;
+    }
+
+    void BfRunner::setInputFile(const QString &fileName) {
+        m_inputFile = fileName;
+    }
+
+    void BfRunner::setEofBehaviour(BfEofBehaviour eof) {
+        m_eofBehaviour = eof;
+    }
+
+    void BfRunner::setCacheEnabled(bool enabled) {
+        m_compiler->setCacheDirectory(enabled ? BfProgramCache::defaultDirectory()
+                                              : QString());
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// SLOTS FOR EXTERNAL USE
+    ///////////////////////////
+    void BfRunner::start() {
+        QFile file(m_sourceFile);
+        if(!file.open(QFile::ReadOnly | QFile::Text)) {
+            QTextStream(stderr) << tr("Error reading file %1: %2\n")
+                                   .arg(m_sourceFile).arg(file.errorString());
+            QCoreApplication::exit(1);
+            return;
+        }
+        if(!openInput() || !openOutput()) {
+            QCoreApplication::exit(1);
+            return;
+        }
+
+        file.close();
+
+        // the compiler reads the file itself, or loads it from the cache
+        emit compileFile(m_sourceFile);
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// SLOTS FOR INTERNAL USE
+    ///////////////////////////
+    void BfRunner::compiled(const QList<BfOpcode> &program, BiHash<IPType,IPType> &,
+                            BfSourceMap &) {
+        // no delay between steps, we want the program to run as fast as possible
+        emit changeDelay(0);
+        // profiling slows every instruction down, so only do it if someone's interested
+        emit changeMemoryProfiling(!m_memoryProfileFile.isEmpty());
+        emit initialize(program);
+    }
+
+    void BfRunner::compilerError(const QString &msg, quint32 pos) {
+        QTextStream(stderr) << tr("%1: compilation error near position %2: %3\n")
+                               .arg(m_sourceFile).arg(pos).arg(msg);
+        QCoreApplication::exit(1);
+    }
+
+    void BfRunner::vmInited() {
+        if(m_started)
+            return;
+        m_started = true;
+        emit toggleRun();
+    }
+
+    void BfRunner::vmInputExhausted() {
+        QTextStream(stderr) << tr("%1: the program needs input, but none is available\n")
+                               .arg(m_sourceFile);
+        finish(2);
+    }
+
+    void BfRunner::vmFinished() {
+        finish(0);
+    }
+
+    void BfRunner::vmMemoryProfile(const BfMemoryProfile &profile) {
+        m_memoryProfile = profile;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// PROTECTED METHODS
+    //////////////////////
+    bool BfRunner::openInput() {
+        // the VM takes the device over, so no parent
+        QFile *input = new QFile();
+        bool ok;
+        if(m_inputFile.isEmpty() || m_inputFile == QLatin1String("-")) {
+            ok = input->open(stdin, QIODevice::ReadOnly | QIODevice::Unbuffered);
+        } else {
+            input->setFileName(m_inputFile);
+            ok = input->open(QIODevice::ReadOnly);
+        }
+        if(!ok) {
+            QTextStream(stderr) << tr("Error reading file %1: %2\n")
+                                   .arg(m_inputFile).arg(input->errorString());
+            delete input;
+            return false;
+        }
+
+        m_vm->setInputDevice(input);
+        emit changeEofBehaviour(m_eofBehaviour);
+        return true;
+    }
+
+    bool BfRunner::openOutput() {
+        /* the VM buffers the output itself and writes it out in big chunks, which beats
+           draining the output channel from here */
+        QFile *output = new QFile();
+        if(!output->open(stdout, QIODevice::WriteOnly)) {
+            QTextStream(stderr) << tr("Error writing to stdout: %1\n")
+                                   .arg(output->errorString());
+            delete output;
+            return false;
+        }
+        m_vm->setOutputDevice(output);
+        return true;
+    }
+
+    void BfRunner::finish(int exitCode) {
+        if(!writeMetrics() && exitCode == 0)
+            exitCode = 1;
+        if(!writeMemoryProfile() && exitCode == 0)
+            exitCode = 1;
+        QCoreApplication::exit(exitCode);
+    }
+
+    bool BfRunner::writeMetrics() {
+        if(m_metricsFile.isEmpty())
+            return true;
+
+        QFile file(m_metricsFile);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream(stderr) << tr("Error writing to file %1: %2\n")
+                                   .arg(m_metricsFile).arg(file.errorString());
+            return false;
+        }
+        QTextStream(&file) << m_vm->metrics().toJson();
+        return true;
+    }
+
+    bool BfRunner::writeMemoryProfile() {
+        if(m_memoryProfileFile.isEmpty())
+            return true;
+
+        QFile file(m_memoryProfileFile);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream(stderr) << tr("Error writing to file %1: %2\n")
+                                   .arg(m_memoryProfileFile).arg(file.errorString());
+            return false;
+        }
+        QTextStream(&file) << m_memoryProfile.toJson();
+        return true;
+    }
+}
@@ -0,0 +1,128 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFRUNNER_H
+#define BFRUNNER_H
+
+#include "bfvm.h"
+#include "bfsourcemap.h"
+#include <QObject>
+#include <QFile>
+
+namespace QtBrain {
+    class BfCompiler;
+
+    /**
+      Runs a Brainfuck program without the GUI.
+
+      The runner reads a source file, compiles it with BfCompiler and runs it in a BfVM
+      at full speed. Compiled programs are cached, so running an unchanged source again
+      skips the compiler. Input is read from a file or stdin, output goes to stdout.
+      When the program finishes, the application is exited, and the VM's metrics are
+      written as JSON if a metrics file was given. The same goes for the memory
+      profile, which is only gathered if it's wanted.
+
+      This is what QtBrain does when started with -run (see main.cpp).
+      */
+    class BfRunner : public QObject
+    {
+        Q_OBJECT
+    public:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PUBLIC METHODS
+        ///////////////////
+        BfRunner(QObject *parent = 0);
+        ~BfRunner();
+
+        void setSourceFile(const QString &fileName);
+        void setMetricsFile(const QString &fileName); /* write the VM's metrics here as
+                                                         JSON when the program ends */
+        void setMemoryProfileFile(const QString &fileName);
+                                                      /* profile the program's memory
+                                                         accesses and write the profile
+                                                         here as JSON */
+        void setInputFile(const QString &fileName);   /* the program's input. Empty or
+                                                         "-" reads from stdin */
+        void setEofBehaviour(BfEofBehaviour eof);     // defaults to EOF_UNCHANGED
+        void setCacheEnabled(bool enabled);           /* whether compiled programs are
+                                                         cached. On by default */
+
+    signals:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// SIGNALS
+        ////////////
+        // these are all connected to the compiler or the VM
+        void compileFile(const QString&);
+        void initialize(const QList<BfOpcode>&);
+        void changeDelay(int);
+        void changeEofBehaviour(BfEofBehaviour);
+        void changeMemoryProfiling(bool);
+        void toggleRun();
+
+    public slots:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// SLOTS FOR EXTERNAL USE
+        ///////////////////////////
+        void start();                   /* reads and compiles the source file. Call this
+                                           from the event loop, the runner exits the
+                                           application when it's done */
+
+    protected slots:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// SLOTS FOR INTERNAL USE
+        ///////////////////////////
+        void compiled(const QList<BfOpcode>&, BiHash<IPType,IPType> &jmps,
+                      BfSourceMap &mappings);
+        void compilerError(const QString&, quint32);
+        void vmInited();
+        void vmInputExhausted();
+        void vmFinished();
+        void vmMemoryProfile(const BfMemoryProfile &profile);
+
+    protected:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PROTECTED MEMBER VARIABLES
+        ///////////////////////////////
+        BfVM            *m_vm;
+        BfCompiler      *m_compiler;
+        QString         m_sourceFile;
+        QString         m_metricsFile;
+        QString         m_memoryProfileFile;
+        BfMemoryProfile m_memoryProfile;/* the VM sends this when it stops, before it
+                                           says it has finished */
+        QString         m_inputFile;
+        BfEofBehaviour  m_eofBehaviour;
+        bool            m_started;      /* the VM emits inited() after every reset, so
+                                           keep track of whether we've started it */
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PROTECTED METHODS
+        //////////////////////
+        bool openInput();               // gives the VM its input device
+        bool openOutput();              // makes the VM write straight to stdout
+        void finish(int exitCode);      // writes the metrics and exits the application
+        bool writeMetrics();
+        bool writeMemoryProfile();
+    };
+}
+#endif // BFRUNNER_H
@@ -0,0 +1,86 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfsampler.h"
+#include <QDebug>
+
+namespace QtBrain {
+
+    BfSampler::BfSampler(const BfVM *vm, QObject *parent) :
+            QThread(parent),
+            m_vm(vm),
+            m_frequency(1000),
+            m_stop(false),
+            m_sampleCount(0)
+    {
+    }
+
+    BfSampler::~BfSampler() {
+        qDebug("~BfSampler()");
+        stopSampling();
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// SLOTS FOR EXTERNAL USE
+    ///////////////////////////
+    void BfSampler::setFrequency(int hz) {
+        m_frequency = qBound(1, hz, 1000000);
+    }
+
+    void BfSampler::startSampling() {
+        if(isRunning())
+            return;
+        qDebug() << "BfSampler::startSampling() at" << m_frequency << "Hz";
+        m_stop = false;
+        start();
+    }
+
+    void BfSampler::stopSampling() {
+        if(!isRunning())
+            return;
+        m_stop = true;
+        wait();
+        qDebug() << "BfSampler::stopSampling()" << m_sampleCount << "samples";
+    }
+
+    void BfSampler::clear() {
+        stopSampling();
+        m_ipSamples.clear();
+        m_dpSamples.clear();
+        m_sampleCount = 0;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////
+    //// PROTECTED METHODS
+    //////////////////////
+    void BfSampler::run() {
+        const unsigned long interval = 1000000 / m_frequency; // in microseconds
+
+        while(!m_stop) {
+            usleep(interval);
+            ++m_ipSamples[m_vm->sampledIP()];
+            ++m_dpSamples[m_vm->sampledDP()];
+            ++m_sampleCount;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFSAMPLER_H
+#define BFSAMPLER_H
+
+#include "bfvm.h"
+#include <QThread>
+#include <QHash>
+
+namespace QtBrain {
+
+    /**
+      A statistical profiler for the BfVM.
+
+      Instead of instrumenting every instruction, the sampler wakes up at a fixed
+      frequency on its own thread and reads the IP and DP the VM last published (see
+      BfVM::sampledIP()). Over a long enough run the sample counts are proportional to
+      the time spent at each instruction, which is all we need to find the hot spots.
+      The only cost to the VM is two stores per instruction.
+
+      The samples are collected while the sampler thread runs and can be read with
+      samples() after stopSampling(). They accumulate over several start/stop cycles
+      until clear() is called.
+      */
+    class BfSampler : public QThread
+    {
+        Q_OBJECT
+    public:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PUBLIC METHODS
+        ///////////////////
+        BfSampler(const BfVM *vm, QObject *parent = 0);
+        ~BfSampler();
+
+        int frequency() const { return m_frequency; }
+
+        /* the samples taken so far, keyed by IP and DP respectively. Only call these
+           when the sampler isn't running */
+        QHash<IPType, quint32> ipSamples() const { return m_ipSamples; }
+        QHash<DPType, quint32> dpSamples() const { return m_dpSamples; }
+        quint64 sampleCount() const { return m_sampleCount; }
+
+    public slots:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// SLOTS FOR EXTERNAL USE
+        ///////////////////////////
+        void setFrequency(int hz);      /* samples per second. Takes effect the next time
+                                           sampling is started */
+        void startSampling();           // starts the sampler thread
+        void stopSampling();            /* stops the sampler thread and waits for it to
+                                           finish */
+        void clear();                   /* throws away all samples. Stops sampling
+                                           first if necessary */
+
+    protected:
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PROTECTED MEMBER VARIABLES
+        ///////////////////////////////
+        const BfVM              *m_vm;
+        int                     m_frequency;    // samples per second
+        volatile bool           m_stop;         /* set to stop the sampling loop. Only
+                                                   read by the sampler thread */
+        QHash<IPType, quint32>  m_ipSamples;    // number of samples taken at each IP
+        QHash<DPType, quint32>  m_dpSamples;    // number of samples taken at each DP
+        quint64                 m_sampleCount;  // total number of samples
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        //// PROTECTED METHODS
+        //////////////////////
+        void run();                             // QThread. The sampling loop
+    };
+}
+#endif // BFSAMPLER_H
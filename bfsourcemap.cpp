@@ -0,0 +1,152 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include "bfsourcemap.h"
+#include <QtAlgorithms>
+
+namespace QtBrain {
+
+    BfSourceMap::BfSourceMap() :
+            m_size(-1)
+    {
+    }
+
+    void BfSourceMap::append(const quint32 *positions, int count) {
+        Q_ASSERT_X(!isCompressed(), "BfSourceMap::append()", "the map is compressed");
+        const int size = m_positions.size();
+        m_positions.resize(size + count);
+        qCopy(positions, positions + count, m_positions.data() + size);
+    }
+
+    void BfSourceMap::clear() {
+        m_positions.clear();
+        m_size = -1;
+        m_blockStarts.clear();
+        m_blockOffsets.clear();
+        m_deltas.clear();
+    }
+
+    quint32 BfSourceMap::value(IPType ip) const {
+        Q_ASSERT_X(containsKey(ip), "BfSourceMap::value()", "no such instruction");
+        if(!isCompressed())
+            return m_positions.at(ip);
+
+        const int block = ip / BLOCK_SIZE;
+        quint32 position = m_blockStarts.at(block);
+        int offset = m_blockOffsets.at(block);
+        for(IPType i = IPType(block) * BLOCK_SIZE; i < ip; ++i)
+            position += readDelta(&offset);
+        return position;
+    }
+
+    IPType BfSourceMap::key(quint32 position) const {
+        if(!isCompressed())
+            return qLowerBound(m_positions.begin(), m_positions.end(), position)
+                    - m_positions.begin();
+
+        // find the last block that starts at or before the position...
+        const QVector<quint32>::const_iterator next =
+                qUpperBound(m_blockStarts.begin(), m_blockStarts.end(), position);
+        if(next == m_blockStarts.begin())
+            return 0;
+        const int block = next - m_blockStarts.begin() - 1;
+
+        // ...and walk it
+        IPType ip = IPType(block) * BLOCK_SIZE;
+        quint32 current = m_blockStarts.at(block);
+        int offset = m_blockOffsets.at(block);
+        while(current < position) {
+            ++ip;
+            if(ip >= IPType(m_size) || ip % BLOCK_SIZE == 0)
+                break;  // the next block starts past the position
+            current += readDelta(&offset);
+        }
+        return ip;
+    }
+
+    void BfSourceMap::copy(IPType first, int count, quint32 *positions) const {
+        Q_ASSERT_X(count == 0 || containsKey(first + count - 1), "BfSourceMap::copy()",
+                   "no such instruction");
+        if(!isCompressed()) {
+            qCopy(m_positions.constData() + first, m_positions.constData() + first + count,
+                  positions);
+            return;
+        }
+
+        // decode from the start of the first block and keep going
+        IPType ip = first - first % BLOCK_SIZE;
+        quint32 position = 0;
+        int offset = 0;
+        for(const IPType end = first + count; ip < end; ++ip) {
+            if(ip % BLOCK_SIZE == 0) {
+                position = m_blockStarts.at(ip / BLOCK_SIZE);
+                offset = m_blockOffsets.at(ip / BLOCK_SIZE);
+            } else {
+                position += readDelta(&offset);
+            }
+            if(ip >= first)
+                *positions++ = position;
+        }
+    }
+
+    void BfSourceMap::compress() {
+        if(isCompressed())
+            return;
+
+        const int size = m_positions.size();
+        m_blockStarts.reserve(size / BLOCK_SIZE + 1);
+        m_blockOffsets.reserve(size / BLOCK_SIZE + 1);
+        m_deltas.reserve(size);
+        for(int i = 0; i < size; ++i) {
+            if(i % BLOCK_SIZE == 0) {
+                m_blockStarts.append(m_positions.at(i));
+                m_blockOffsets.append(m_deltas.size());
+                continue;
+            }
+            // 7 bits at a time, the high bit is set on all but the last byte
+            quint32 delta = m_positions.at(i) - m_positions.at(i-1);
+            while(delta >= 0x80) {
+                m_deltas.append(char(0x80 | (delta & 0x7f)));
+                delta >>= 7;
+            }
+            m_deltas.append(char(delta));
+        }
+        m_deltas.squeeze();
+
+        m_size = size;
+        m_positions = QVector<quint32>();   // actually frees the memory
+    }
+
+    quint32 BfSourceMap::readDelta(int *offset) const {
+        const uchar *data = reinterpret_cast<const uchar*>(m_deltas.constData());
+        quint32 delta = 0;
+        int shift = 0;
+        uchar byte;
+        do {
+            byte = data[(*offset)++];
+            delta |= quint32(byte & 0x7f) << shift;
+            shift += 7;
+        } while(byte & 0x80);
+        return delta;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+Copyright 2010 Tom Eklof. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY TOM EKLOF ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL TOM EKLOF OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef BFSOURCEMAP_H
+#define BFSOURCEMAP_H
+
+#include "bfvm.h"
+#include <QVector>
+#include <QByteArray>
+
+namespace QtBrain {
+
+    /**
+      Maps the instructions of a compiled program to their positions in the source.
+
+      Instructions are compiled in source order, so the positions only ever grow and
+      the map can be a plain array indexed by the IP. Looking up the position of an
+      instruction is then O(1), and going the other way is a binary search. That's 4 bytes
+      per instruction, compared to two QHash nodes per instruction with a BiHash.
+
+      For really large programs the map can be compress()ed: the positions are stored as
+      the varint encoded differences between them, which is usually a byte each, with
+      the full position of every BLOCK_SIZEth instruction kept on the side so a lookup
+      never has to decode more than one block.
+
+      The interface is the same as the BiHash that was used before: the IPs are the keys
+      and the positions are the values.
+      */
+    class BfSourceMap
+    {
+    public:
+        BfSourceMap();
+
+        /* adds the position of the next instruction. Positions have to be given in
+           increasing order, and the map can't be compressed */
+        void append(quint32 position) { m_positions.append(position); }
+        void append(const quint32 *positions, int count);
+
+        void reserve(int size) { m_positions.reserve(size); }
+        void clear();
+
+        int size() const { return m_size >= 0 ? m_size : m_positions.size(); }
+        bool isEmpty() const { return size() == 0; }
+
+        // true if there is an instruction at ip
+        bool containsKey(IPType ip) const { return ip < IPType(size()); }
+
+        // the source position of the instruction at ip, which has to exist
+        quint32 value(IPType ip) const;
+
+        /* the first instruction at or after the source position. Returns size() if
+           there is none */
+        IPType key(quint32 position) const;
+
+        /* copies the positions of count instructions starting at first into positions.
+           Much faster than calling value() for each when the map is compressed */
+        void copy(IPType first, int count, quint32 *positions) const;
+
+        bool isCompressed() const { return m_size >= 0; }
+        void compress();            // see the class description. Can't be undone
+
+        static const int BLOCK_SIZE = 64;
+
+    protected:
+        QVector<quint32>    m_positions;    // when not compressed
+
+        // when compressed
+        int                 m_size;         // number of instructions, -1 if not compressed
+        QVector<quint32>    m_blockStarts;  // the position of the first instruction...
+        QVector<int>        m_blockOffsets; // ...and where the rest of the block begins
+        QByteArray          m_deltas;       // varint encoded differences
+
+        // decodes one varint from m_deltas at *offset and moves past it
+        quint32 readDelta(int *offset) const;
+    };
+}
+#endif // BFSOURCEMAP_H
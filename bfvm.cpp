@@ -24,6 +24,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "bfvm.h"
 #include "customTransitions.h"
 #include <stdexcept>
+#include <cstring>
 #include <QStateMachine>
 #include <QState>
 #include <QAbstractTransition>
@@ -32,9 +33,228 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QStack>
 #include <QByteArray>
 #include <QHistoryState>
+#include <QTextStream>
+#include <QCoreApplication>
+#include <QFile>
+#include <QtAlgorithms>
+#include <QRegExp>
+#include <QStringList>
+#include <QSocketNotifier>
+#include <cerrno>
+#ifdef Q_OS_UNIX
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 namespace QtBrain {
 
+    namespace {
+        // a cell and its access count, see BfMemoryProfile::hottest()
+        typedef QPair<quint64, DPType> CellCount;
+
+        // more accesses first, lower addresses first when even
+        bool hotter(const CellCount &a, const CellCount &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    }
+
+    BfVMMetrics::BfVMMetrics() :
+            instructions(0),
+            branchesTaken(0),
+            inputBytes(0),
+            outputBytes(0),
+            eventsPosted(0),
+            signalsEmitted(0)
+    {
+        for(int op = 0; op < INVALID; ++op) {
+            retired[op] = 0;
+        }
+    }
+
+    QString BfVMMetrics::toJson() const {
+        QString json;
+        QTextStream out(&json);
+
+        out << "{\n  \"instructions\": " << instructions << ",\n  \"retired\": {";
+        for(int op = 0; op < INVALID; ++op) {
+            out << (op ? ", " : "") << '"' << OPCODENAMES[op] << "\": " << retired[op];
+        }
+        out << "},\n"
+            << "  \"branchesTaken\": " << branchesTaken << ",\n"
+            << "  \"inputBytes\": " << inputBytes << ",\n"
+            << "  \"outputBytes\": " << outputBytes << ",\n"
+            << "  \"eventsPosted\": " << eventsPosted << ",\n"
+            << "  \"signalsEmitted\": " << signalsEmitted << "\n}\n";
+        out.flush();
+        return json;
+    }
+
+
+    int BfMemoryProfile::cellsTouched() const {
+        int touched = 0;
+        for(int i = 0; i < reads.size(); ++i) {
+            if(reads[i] != 0 || writes[i] != 0)
+                ++touched;
+        }
+        return touched;
+    }
+
+    QList<DPType> BfMemoryProfile::hottest(int count) const {
+        QVector<CellCount> cells;
+        for(int i = 0; i < reads.size(); ++i) {
+            const quint64 accesses = reads[i] + writes[i];
+            if(accesses != 0)
+                cells.append(CellCount(accesses, DPType(i)));
+        }
+        qSort(cells.begin(), cells.end(), hotter);
+
+        QList<DPType> result;
+        for(int i = 0; i < cells.size() && i < count; ++i) {
+            result.append(cells[i].second);
+        }
+        return result;
+    }
+
+    QString BfMemoryProfile::toJson(int hottestCount) const {
+        quint64 totalReads = 0, totalWrites = 0;
+        for(int i = 0; i < reads.size(); ++i) {
+            totalReads += reads[i];
+            totalWrites += writes[i];
+        }
+
+        QString json;
+        QTextStream out(&json);
+        out << "{\n  \"minDp\": " << (isEmpty() ? 0 : minDp) << ",\n"
+            << "  \"maxDp\": " << (isEmpty() ? 0 : maxDp) << ",\n"
+            << "  \"span\": " << span() << ",\n"
+            << "  \"cellsTouched\": " << cellsTouched() << ",\n"
+            << "  \"reads\": " << totalReads << ",\n"
+            << "  \"writes\": " << totalWrites << ",\n"
+            << "  \"hottest\": [";
+        const QList<DPType> hot = hottest(hottestCount);
+        for(int i = 0; i < hot.size(); ++i) {
+            out << (i ? ", " : "") << "{\"cell\": " << hot[i] << ", \"reads\": "
+                << reads[hot[i]] << ", \"writes\": " << writes[hot[i]] << '}';
+        }
+        out << "]\n}\n";
+        out.flush();
+        return json;
+    }
+
+
+    BfCondition BfCondition::parse(const QString &text, QString *error) {
+        static const QRegExp comparison(QLatin1String(
+                "^\\s*([^\\s=!<>]+)\\s*(==|!=|<=|>=|<|>)\\s*([^\\s=!<>]+)\\s*$"));
+
+        BfCondition result;
+        result.m_text = text.simplified();
+        if(result.m_text.isEmpty())
+            return result;
+
+        foreach(const QString &part, text.split(QLatin1String("&&"))) {
+            QRegExp re(comparison);
+            Term term;
+            if(!re.exactMatch(part)) {
+                result.m_valid = false;
+                if(error != 0)
+                    *error = QObject::tr("\"%1\" isn't a comparison").arg(part.trimmed());
+                return result;
+            }
+            for(int side = 0; side < 2; ++side) {
+                const QString operand = re.cap(side == 0 ? 1 : 3);
+                if(!parseOperand(operand, side == 0 ? &term.left : &term.right)) {
+                    result.m_valid = false;
+                    if(error != 0)
+                        *error = QObject::tr("Unknown operand \"%1\"").arg(operand);
+                    return result;
+                }
+            }
+            static const char *const OPERATORS[] = {"==", "!=", "<", "<=", ">", ">="};
+            for(int c = EQ; c <= GE; ++c) {
+                if(re.cap(2) == QLatin1String(OPERATORS[c]))
+                    term.comparison = Comparison(c);
+            }
+            result.m_terms.append(term);
+        }
+        return result;
+    }
+
+    bool BfCondition::parseOperand(const QString &text, Operand *operand) {
+        static const QRegExp cell(QLatin1String("^mem\\[(\\d+)\\]$"), Qt::CaseInsensitive);
+
+        bool ok;
+        operand->value = text.toInt(&ok);
+        if(ok) {
+            operand->kind = CONSTANT;
+        } else if(text.compare(QLatin1String("DP"), Qt::CaseInsensitive) == 0) {
+            operand->kind = DP_VALUE;
+        } else if(text.compare(QLatin1String("*DP"), Qt::CaseInsensitive) == 0) {
+            operand->kind = CELL_AT_DP;
+        } else {
+            QRegExp re(cell);
+            if(!re.exactMatch(text))
+                return false;
+            operand->kind = CELL;
+            operand->value = re.cap(1).toInt(&ok);
+            if(!ok || operand->value > BfVM::MAX_MEM_ADDR)
+                return false;
+        }
+        return true;
+    }
+
+
+    BfVMView::BfVMView(const Memtype *cells, int size) :
+            m_cells(cells),
+            m_size(size),
+            m_sequence(0),
+            m_ip(0),
+            m_dp(0)
+    {
+    }
+
+    /* the ordered atomics are full barriers, so everything is written strictly
+       between the two increments. There's only ever one writer */
+    void BfVMView::publish(IPType ip, DPType dp, const BfVMMetrics &metrics) {
+        m_sequence.fetchAndAddOrdered(1);
+        m_ip = ip;
+        m_dp = dp;
+        m_metrics = metrics;
+        m_sequence.fetchAndAddOrdered(1);
+    }
+
+    int BfVMView::beginRead() const {
+        forever {
+            // adding 0 is the only way to do an ordered load in Qt 4
+            const int sequence = m_sequence.fetchAndAddOrdered(0);
+            if(!(sequence & 1))
+                return sequence;
+            // the VM is in the middle of a few stores, it won't be long
+        }
+    }
+
+    bool BfVMView::endRead(int sequence) const {
+        return m_sequence.fetchAndAddOrdered(0) == sequence;
+    }
+
+    quint32 BfVMView::registers(IPType *ip, DPType *dp) const {
+        int sequence;
+        do {
+            sequence = beginRead();
+            *ip = m_ip;
+            *dp = m_dp;
+        } while(!endRead(sequence));
+        return quint32(sequence) / 2;
+    }
+
+    BfVMMetrics BfVMView::metrics() const {
+        BfVMMetrics metrics;
+        int sequence;
+        do {
+            sequence = beginRead();
+            metrics = m_metrics;
+        } while(!endRead(sequence));
+        return metrics;
+    }
 
 
     BfVM::BfVM(QObject *parent) :
@@ -45,8 +265,34 @@ namespace QtBrain {
             m_jmps(new BiHash<IPType,IPType>()),
             m_program(NULL),
             m_runTimer(new QTimer(this)),
-            m_inputBuffer(new QQueue<Memtype>()),
-            m_breakpoints(new QList<IPType>()),
+            m_inputChannel(new BfByteChannel(INPUT_CHANNEL_SIZE)),
+            m_inputDevice(NULL),
+            m_inputFd(-1),
+            m_inputNotifier(NULL),
+            m_inputChunk(new char[INPUT_CHUNK_SIZE]),
+            m_inputEof(false),
+            m_eofBehaviour(EOF_WAIT),
+            m_outputChannel(new BfByteChannel(OUTPUT_CHANNEL_SIZE)),
+            m_outputDevice(NULL),
+            m_outputBuffer(new char[OUTPUT_BUFFER_SIZE]),
+            m_outputBuffered(0),
+            m_breakpoints(new QHash<IPType, PatchedBreakpoint>()),
+            m_watchpoints(new QList<Watchpoint>()),
+            m_watching(false),
+            m_watched(new bool[MAX_MEM_ADDR+1]),
+            m_resumeIP(NO_BREAKPOINT),
+            m_loopProfiling(false),
+            m_loopProfile(new QHash<IPType, LoopProfile>()),
+            m_activeLoops(new QStack<ActiveLoop>()),
+            m_memoryProfiling(false),
+            m_cellReads(new quint64[MAX_MEM_ADDR+1]),
+            m_cellWrites(new quint64[MAX_MEM_ADDR+1]),
+            m_profilesEmitted(true),
+            m_yield(false),
+            m_view(m_memory, MAX_MEM_ADDR+1),
+            m_dirtyStart(MAX_MEM_ADDR),
+            m_dirtyEnd(0),
+            m_inputConsumed(0),
             m_stateMachine(new QStateMachine(this)), ///// STATE INITIALIZATIONS
             m_stateGroup(new QState()),
             m_runGroup(new QState(m_stateGroup)),
@@ -62,9 +308,25 @@ namespace QtBrain {
 
     {
         qDebug() << "BfVM::BfVM()\nLargest address:" << MAX_MEM_ADDR;
+        Q_ASSERT_X(parent == 0, "BfVM::BfVM()", "the VM can't be moved to its thread "
+                                                 "if it has a parent");
+
+        // everything crossing the thread boundary in a queued signal has to be registered
+        qRegisterMetaType<QList<BfOpcode> >("QList<BfOpcode>");
+        qRegisterMetaType<IPType>("IPType");
+        qRegisterMetaType<DPType>("DPType");
+        qRegisterMetaType<QList<LoopProfile> >("QList<LoopProfile>");
+        qRegisterMetaType<BfMemoryProfile>("BfMemoryProfile");
+        qRegisterMetaType<BfBreakpoint>("BfBreakpoint");
+        qRegisterMetaType<BfCondition>("BfCondition");
+        qRegisterMetaType<BfVMSnapshot>("BfVMSnapshot");
+        qRegisterMetaType<BfEofBehaviour>("BfEofBehaviour");
+        qRegisterMetaType<QIODevice*>("QIODevice*");
 
         // initialize memory to all 0
         clearMemory();
+        clearMemoryProfile();
+        clearWatchpoints();
 
         initializeStateMachine();
         m_stateMachine->start();
@@ -74,7 +336,13 @@ namespace QtBrain {
 
         m_runTimer->setInterval(m_runDelay);
         // running a program is just "single-stepping by the clock."
-        connect(m_runTimer, SIGNAL(timeout()), this, SLOT(step()));
+        connect(m_runTimer, SIGNAL(timeout()), this, SLOT(tick()));
+
+        m_snapshotClock.start();
+
+        /* the VM's slots are run in its own thread, so a long run doesn't block the GUI.
+           The timer and the state machine are children, so they move along */
+        moveToThread(this);
     }
 
 
@@ -248,8 +516,21 @@ namespace QtBrain {
         delete m_jmps;
         delete[] m_program;
         delete m_stateGroup;
-        delete m_inputBuffer;
+        delete m_inputChannel;
+        delete m_inputNotifier;
+        delete m_inputDevice;
+        delete[] m_inputChunk;
+        delete m_outputChannel;
+        flushOutput();
+        delete m_outputDevice;
+        delete[] m_outputBuffer;
         delete m_breakpoints;
+        delete m_watchpoints;
+        delete[] m_watched;
+        delete m_loopProfile;
+        delete[] m_cellReads;
+        delete[] m_cellWrites;
+        delete m_activeLoops;
     }
 
     /////////////////////////////////////////////////////////////////////////////////////////
@@ -257,27 +538,25 @@ namespace QtBrain {
     //////////
     void BfVM::step() {
         qDebug("BfVM::step()");
+        m_profilesEmitted = false;
+        execute();
+        // single steps are slow enough that the GUI can follow every one of them
+        publishSnapshot(true);
+    }
 
-        //Q_ASSERT_X(m_IP < m_programSize, "BfVM::step()", "IP larger than program size");
-        /* If we've reached the last instruction, post an EndEvent and let the state machine
-           handle the rest */
-        if(m_IP >= m_programSize) {
-            qDebug("BfVM::step() program end reached");
-            m_stateMachine->postEvent(new EndEvent);
-            return;
+    void BfVM::tick() {
+        if(m_runDelay > 0) {
+            execute();
+            publishSnapshot(false);
+        } else {
+            runSlice();
         }
-        // Inform the world of our IP
-        emit heartBeat(m_IP);
-
-        // NOTE: the IP is increased by the runInstruction() function
-        runInstruction(m_program[m_IP]);
-
-        // emit "heart beat" with current IP and then increase it
     }
 
     void BfVM::go() {
         qDebug("BfVM::go()");
         // Look ma, no loops!
+        m_profilesEmitted = false;
         m_runTimer->start();
         emit running(true);
 #ifndef QT_NO_DEBUG
@@ -288,7 +567,17 @@ namespace QtBrain {
     void BfVM::stop() {
         qDebug() << "BfVM::stop()";
         m_runTimer->stop();
+        // make sure whoever's watching sees where we stopped, and everything up to there
+        flushOutput();
+        publishSnapshot(true);
         emit running(false);
+        if(!m_profilesEmitted) {
+            if(m_loopProfiling)
+                emitLoopProfile();
+            if(m_memoryProfiling)
+                emitMemoryProfile();
+            m_profilesEmitted = true;
+        }
 #ifndef QT_NO_DEBUG
         listStates();
 #endif
@@ -300,7 +589,26 @@ namespace QtBrain {
         m_DP = 0;
         m_IP = 0;
         clearMemory();
-        m_inputBuffer->clear();
+        m_inputChannel->skip(m_inputChannel->available());
+        m_pendingInput.clear();
+        // run the program on the same input again, if the device can do that
+        if(m_inputDevice != NULL && !m_inputDevice->isSequential()) {
+            m_inputDevice->seek(0);
+            m_inputEof = false;
+        }
+        m_metrics = BfVMMetrics();
+        m_dirtyStart = MAX_MEM_ADDR;
+        m_dirtyEnd = 0;
+        m_inputConsumed = 0;
+        m_view.publish(m_IP, m_DP, m_metrics);
+        m_resumeIP = NO_BREAKPOINT;
+        QHash<IPType, PatchedBreakpoint>::iterator bp;
+        for(bp = m_breakpoints->begin(); bp != m_breakpoints->end(); ++bp) {
+            bp->hits = 0;
+        }
+        m_loopProfile->clear();
+        m_activeLoops->clear();
+        clearMemoryProfile();
         emit resetted();
 #ifndef QT_NO_DEBUG
         listStates();
@@ -337,26 +645,180 @@ namespace QtBrain {
     void BfVM::input(const QString &in) {
         qDebug("BfVM::input()");
         // is the buffer currently empty?
-        bool wasBufEmpty = m_inputBuffer->isEmpty();
-
-        if(in.size() > 0) {
-            m_inputBuffer->clear();
-            const QByteArray ba = in.toAscii();
-            const char *inp = ba.data();
-            while (*inp) {  // QByteArrays are null-terminated, so this should work
-                m_inputBuffer->enqueue(*inp);
-                ++inp;
-            }
-        }
+        bool wasBufEmpty = m_inputChannel->available() == 0;
+
+        /* input() runs in the VM's thread, so the VM is both producer and consumer here.
+           Whatever doesn't fit now goes in as INP makes room */
+        m_pendingInput.append(in.toAscii());
+        fillInputChannel();
         /* if the buffer was empty, post an event notifying that it was filled.
            There is no need to check what state the VM is in since this event is ignored
            by all but the pertinent states */
         if(wasBufEmpty)
-            m_stateMachine->postEvent(new InputBufferFilledEvent());
+            postStateEvent(new InputBufferFilledEvent());
     }
 
+    void BfVM::setEofBehaviour(BfEofBehaviour eof) {
+        m_eofBehaviour = eof;
+    }
+
+    void BfVM::setInputDevice(QIODevice *device) {
+        if(device != NULL) {
+            Q_ASSERT_X(device->parent() == 0, "BfVM::setInputDevice()",
+                       "the input device can't be moved to the VM's thread");
+            device->moveToThread(this);
+        }
+        // the device is only ever touched from the VM's thread
+        QMetaObject::invokeMethod(this, "changeInputDevice", Q_ARG(QIODevice*, device));
+    }
+
+    void BfVM::changeInputDevice(QIODevice *device) {
+        qDebug("BfVM::changeInputDevice()");
+        if(m_inputDevice != NULL) {
+            m_inputDevice->disconnect(this);
+            delete m_inputDevice;
+        }
+        delete m_inputNotifier;
+        m_inputNotifier = NULL;
+        m_inputFd = -1;
+        m_inputDevice = device;
+        m_inputEof = false;
+
+#ifdef Q_OS_UNIX
+        /* QFile keeps reading a pipe or a terminal until it has as much as it was asked
+           for, which would leave an interactive program waiting for a whole chunk of
+           input. Those are read from the descriptor instead, only when it has
+           something, and the notifier wakes the VM up when it does */
+        QFile *file = qobject_cast<QFile*>(device);
+        if(file != NULL && file->isSequential() && file->handle() >= 0) {
+            m_inputFd = file->handle();
+            m_inputNotifier = new QSocketNotifier(m_inputFd, QSocketNotifier::Read, this);
+            m_inputNotifier->setEnabled(false);
+            connect(m_inputNotifier, SIGNAL(activated(int)), this, SLOT(inputFdReadable()));
+        }
+#endif
+
+        if(m_inputDevice != NULL) {
+            connect(m_inputDevice, SIGNAL(readyRead()), this, SLOT(inputDeviceReadyRead()));
+            connect(m_inputDevice, SIGNAL(readChannelFinished()), this,
+                    SLOT(inputDeviceFinished()));
+            // if the VM is waiting for input, the new device may have some
+            postStateEvent(new InputBufferFilledEvent());
+        }
+    }
+
+    void BfVM::setOutputDevice(QIODevice *device) {
+        if(device != NULL) {
+            Q_ASSERT_X(device->parent() == 0, "BfVM::setOutputDevice()",
+                       "the output device can't be moved to the VM's thread");
+            device->moveToThread(this);
+        }
+        QMetaObject::invokeMethod(this, "changeOutputDevice", Q_ARG(QIODevice*, device));
+    }
+
+    void BfVM::changeOutputDevice(QIODevice *device) {
+        qDebug("BfVM::changeOutputDevice()");
+        // the old device gets everything that was meant for it
+        flushOutput();
+        delete m_outputDevice;
+        m_outputDevice = device;
+    }
+
+    void BfVM::inputDeviceReadyRead() {
+        /* the data is read when INP needs it, so all there is to do is wake up the VM
+           if it's waiting */
+        if(m_inputChannel->available() == 0)
+            postStateEvent(new InputBufferFilledEvent());
+    }
+
+    void BfVM::inputFdReadable() {
+        // the descriptor stays readable until it's read, which happens when INP runs
+        m_inputNotifier->setEnabled(false);
+        postStateEvent(new InputBufferFilledEvent());
+    }
+
+    void BfVM::inputDeviceFinished() {
+        qDebug("BfVM::inputDeviceFinished()");
+        m_inputEof = true;
+        // a waiting INP can now do whatever m_eofBehaviour says
+        postStateEvent(new InputBufferFilledEvent());
+    }
+
+    /* breakpoints are patched into the program as BRKs, which the VM checks for
+       anyway. A BRK that is already there is a breakpoint in the source */
     void BfVM::setBreakpoint(IPType pos) {
-        m_breakpoints->append(pos);
+        setBreakpoint(pos, BfBreakpoint());
+    }
+
+    void BfVM::setBreakpoint(IPType pos, const BfBreakpoint &bp) {
+        qDebug() << "BfVM::setBreakpoint()" << pos << bp.condition.text() << bp.hitCount;
+        if(pos >= m_programSize || !bp.condition.isValid())
+            return;
+
+        QHash<IPType, PatchedBreakpoint>::iterator it = m_breakpoints->find(pos);
+        if(it != m_breakpoints->end()) {
+            it->breakpoint = bp;
+            it->hits = 0;
+            return;
+        }
+        if(m_program[pos] == BRK)
+            return;
+
+        PatchedBreakpoint pb = {m_program[pos], bp, 0};
+        m_breakpoints->insert(pos, pb);
+        m_program[pos] = BRK;
+    }
+
+    void BfVM::clearBreakpoint(IPType pos) {
+        qDebug() << "BfVM::clearBreakpoint()" << pos;
+        if(!m_breakpoints->contains(pos))
+            return;
+        m_program[pos] = m_breakpoints->take(pos).replaced;
+        if(m_resumeIP == pos)
+            m_resumeIP = NO_BREAKPOINT;
+    }
+
+    void BfVM::clearBreakpoints() {
+        QHash<IPType, PatchedBreakpoint>::const_iterator it;
+        for(it = m_breakpoints->constBegin(); it != m_breakpoints->constEnd(); ++it) {
+            m_program[it.key()] = it.value().replaced;
+        }
+        m_breakpoints->clear();
+        m_resumeIP = NO_BREAKPOINT;
+    }
+
+    /* writes are checked by markDirty(), which only looks at the watched cell flags at
+       all when there are watchpoints. That's a lot cheaper than trapping writes with
+       page protection would be on a tape this small */
+    void BfVM::addWatchpoint(DPType first, DPType last, const BfCondition &condition) {
+        qDebug() << "BfVM::addWatchpoint()" << first << last << condition.text();
+        if(first > last || !condition.isValid())
+            return;
+        Watchpoint wp = {first, last, condition};
+        m_watchpoints->append(wp);
+        for(int cell = first; cell <= last; ++cell) {
+            m_watched[cell] = true;
+        }
+        m_watching = true;
+    }
+
+    void BfVM::clearWatchpoints() {
+        m_watchpoints->clear();
+        m_watching = false;
+        memset(m_watched, 0, (MAX_MEM_ADDR+1) * sizeof(bool));
+    }
+
+    void BfVM::setLoopProfiling(bool on) {
+        qDebug() << "BfVM::setLoopProfiling()" << on;
+        m_loopProfiling = on;
+        /* we don't know which loops we're inside of if profiling was off, so start
+           tracking from scratch. JNZs of loops entered before this are ignored. */
+        m_activeLoops->clear();
+    }
+
+    void BfVM::setMemoryProfiling(bool on) {
+        qDebug() << "BfVM::setMemoryProfiling()" << on;
+        m_memoryProfiling = on;
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////
@@ -381,11 +843,22 @@ namespace QtBrain {
     // QThread's run()
     void BfVM::run() {
         qDebug("BfVM::run() VM thread running");
+        exec();
+        if(m_inputDevice != NULL)
+            m_inputDevice->moveToThread(QCoreApplication::instance()->thread());
+        if(m_outputDevice != NULL)
+            m_outputDevice->moveToThread(QCoreApplication::instance()->thread());
+        // give the object back to the main thread so it can be deleted from there
+        moveToThread(QCoreApplication::instance()->thread());
+        qDebug("BfVM::run() VM thread finished");
     }
 
     void BfVM::doinit(const QList<BfOpcode> &opc) {
         emit resetSig();
         m_programSize = opc.size();
+        // the breakpoints were set in the old program
+        m_breakpoints->clear();
+        m_resumeIP = NO_BREAKPOINT;
 
         //m_program->clear();
         //m_program->append(opc);
@@ -395,7 +868,7 @@ namespace QtBrain {
         }
 
         m_program = new BfOpcode[m_programSize];
-        for(int i = 0; i < m_programSize; ++i) {
+        for(IPType i = 0; i < m_programSize; ++i) {
             m_program[i] = opc[i];
         }
 
@@ -404,7 +877,7 @@ namespace QtBrain {
 
 
         // tell the state machine that initialization is done
-        m_stateMachine->postEvent(new InitedEvent);
+        postStateEvent(new InitedEvent);
         qDebug() << "BfVM::doinit(QList);";
 #ifndef QT_NO_DEBUG
         listStates();
@@ -415,32 +888,54 @@ namespace QtBrain {
     void BfVM::runInstruction(const BfOpcode &op) {
         qDebug("BfVM::runInstruction()");
         qDebug("IP=%d\t%s\tDP=%d (%d)",m_IP,OPCODENAMES[op],m_DP,m_memory[m_DP]);
+        if(m_loopProfiling && (op == JZ || op == JNZ))
+            profileLoop(op);
+
         switch(op) {
         case(BRK): // breakpoint, yay
+            if(m_breakpoints->contains(m_IP)) { // set with setBreakpoint()
+                PatchedBreakpoint &pb = (*m_breakpoints)[m_IP];
+                /* when carrying on from the breakpoint, or when it isn't hit or this
+                   isn't the hit to stop on, run the instruction that's really here */
+                if(m_resumeIP == m_IP || !pb.breakpoint.condition.evaluate(m_memory, m_DP)
+                        || (++pb.hits != pb.breakpoint.hitCount
+                            && pb.breakpoint.hitCount != 0)) {
+                    runReplaced(pb.replaced);
+                    return;
+                }
+                m_resumeIP = m_IP;
+                emit breakpoint(m_IP, m_DP);
+                ++m_metrics.signalsEmitted;
+                postStateEvent(new BreakpointEvent);
+                return; // the IP stays put and nothing was retired
+            }
             emit breakpoint(m_IP, m_DP);
-            m_stateMachine->postEvent(new BreakpointEvent);
+            ++m_metrics.signalsEmitted;
+            postStateEvent(new BreakpointEvent);
             ++m_IP;
             break;
         case(DPINC):  // ++DP
             /* there's no need to check for overflows here or in SUBDP since it's desireable
                that the DP roll over when reaching either end */
-            emit DPChanged(++m_DP);
+            ++m_DP;
             ++m_IP;
             break;
 
         case(DPDEC): // --DP
-            emit DPChanged(--m_DP);
+            --m_DP;
             ++m_IP;
             break;
 
         case(ADD): // ++*DP
             // Again no overflow checking since it's OK to overflow
-            emit memChanged(m_DP, ++m_memory[m_DP]);
+            ++m_memory[m_DP];
+            markDirty();
             ++m_IP;
             break;
 
         case(SUB): // --*DP
-            emit memChanged(m_DP, --m_memory[m_DP]);
+            --m_memory[m_DP];
+            markDirty();
             ++m_IP;
             break;
 
@@ -448,6 +943,7 @@ namespace QtBrain {
             if(m_memory[m_DP] == 0) {
                 qDebug() << "JZ: *DP==0, set IP to"<<m_jmps->value(m_IP)+1;
                 m_IP = m_jmps->value(m_IP)+1; // AFTER the matching JNZ!
+                ++m_metrics.branchesTaken;
                 break;
             }
             ++m_IP;
@@ -457,12 +953,29 @@ namespace QtBrain {
             if(m_memory[m_DP] != 0) {
                 qDebug() << "JNZ: *DP!=0, set IP to"<<m_jmps->key(m_IP)+1;
                 m_IP = m_jmps->key(m_IP)+1; // AFTER the matching JZ!
+                ++m_metrics.branchesTaken;
                 break;
             }
             ++m_IP;
             break;
         case(OUT):
-            emit output(m_memory[m_DP]);
+            if(m_outputDevice != NULL) {
+                m_outputBuffer[m_outputBuffered++] = m_memory[m_DP];
+                if(m_outputBuffered == OUTPUT_BUFFER_SIZE)
+                    flushOutput();
+            } else if(!m_outputChannel->put(m_memory[m_DP])) {
+                /* nobody's reading the output fast enough. Let them know there's
+                   something to read and give them a moment */
+                publishSnapshot(true);
+                if(!m_outputChannel->waitForSpace(OUTPUT_WAIT)
+                    || !m_outputChannel->put(m_memory[m_DP])) {
+                    // try the same OUT again on the next tick
+                    qDebug("BfVM::runInstruction() output channel full");
+                    m_yield = true;
+                    return;
+                }
+            }
+            ++m_metrics.outputBytes;
             qDebug() << "BfVM::runInstruction() output:"<<m_memory[m_DP];
             ++m_IP;
             break;
@@ -475,29 +988,223 @@ namespace QtBrain {
                *actually* do the INP command.
 
                In others words, if there's nothing in the input buffer we just leave
-               the handling of the situation to the state machine.*/
+               the handling of the situation to the state machine.
+
+               Whoever is on the other end may want to see the prompt before answering,
+               so buffered output is written out first. */
+            flushOutput();
 
             if(checkInputBuffer()) {
                 m_memory[m_DP] = getInput();
+                markDirty();
                 qDebug("INP read %d",m_memory[m_DP]);
                 ++m_IP;
 #ifndef QT_NO_DEBUG
         listStates();
 #endif
+            } else if(m_inputEof && m_eofBehaviour != EOF_WAIT) {
+                qDebug("INP end of input");
+                readEof();
+                ++m_IP;
             } else {
                 qDebug("INP input buffer empty");
 #ifndef QT_NO_DEBUG
         listStates();
 #endif
+                return; // nothing was executed, so nothing was retired either
             }
             break;
         default:
             qDebug() << "WEIRD INSTRUCTION FOUND:"<<QString::number(op);
             throw std::runtime_error("VM got a bad instruction");
         }
+        ++m_metrics.instructions;
+        ++m_metrics.retired[op];
+        /* only now, so that an OUT that's retried or a breakpoint that runs the
+           instruction it replaced isn't counted twice */
+        if(m_memoryProfiling)
+            profileMemory(op);
         qDebug("New IP=%d DP=%d (%d)",m_IP,m_DP,m_memory[m_DP]);
     }
 
+    void BfVM::profileLoop(const BfOpcode &op) {
+        const bool zero = (m_memory[m_DP] == 0);
+
+        if(op == JZ) {
+            LoopProfile &lp = (*m_loopProfile)[m_IP];
+            if(lp.entries == 0) {
+                lp.jz = m_IP;
+                lp.jnz = m_jmps->value(m_IP);
+            }
+            ++lp.entries;
+
+            if(zero) { // the loop is skipped, so only the JZ itself is run
+                ++lp.instructions;
+                return;
+            }
+
+            ++lp.iterations;
+            ActiveLoop al = {m_IP, 1, m_metrics.instructions};
+            m_activeLoops->push(al);
+            return;
+        }
+
+        // JNZ
+        const IPType jz = m_jmps->key(m_IP);
+        if(m_activeLoops->isEmpty() || m_activeLoops->top().jz != jz) {
+            // the entry happened while profiling was off
+            return;
+        }
+
+        LoopProfile &lp = (*m_loopProfile)[jz];
+        if(!zero) { // jumping back for another iteration
+            ++m_activeLoops->top().iterations;
+            ++lp.iterations;
+            return;
+        }
+
+        // leaving the loop. +1 since the JNZ hasn't been retired yet
+        const ActiveLoop al = m_activeLoops->pop();
+        lp.instructions += m_metrics.instructions + 1 - al.retiredAtEntry;
+        lp.maxIterations = qMax(lp.maxIterations, al.iterations);
+    }
+
+    void BfVM::emitLoopProfile() {
+        QHash<IPType, LoopProfile> profile(*m_loopProfile);
+
+        // loops we're still inside of haven't been accounted for yet
+        foreach(const ActiveLoop &al, *m_activeLoops) {
+            LoopProfile &lp = profile[al.jz];
+            lp.instructions += m_metrics.instructions - al.retiredAtEntry;
+            lp.maxIterations = qMax(lp.maxIterations, al.iterations);
+        }
+
+        emit loopProfile(profile.values());
+        ++m_metrics.signalsEmitted;
+    }
+
+    void BfVM::profileMemory(const BfOpcode &op) {
+        if(m_DP < m_profileMinDp)
+            m_profileMinDp = m_DP;
+        if(m_DP > m_profileMaxDp)
+            m_profileMaxDp = m_DP;
+
+        switch(op) {
+        case ADD:
+        case SUB:
+        case OUT:
+        case JZ:
+        case JNZ:
+            ++m_cellReads[m_DP];
+            break;
+        default:
+            break;
+        }
+    }
+
+    void BfVM::runReplaced(BfOpcode op) {
+        const IPType ip = m_IP;
+        runInstruction(op);
+        /* an INP waiting for input doesn't move the IP. It's retried when the input
+           comes, and that's neither a new hit nor a reason to stop again */
+        m_resumeIP = (m_IP == ip) ? ip : NO_BREAKPOINT;
+    }
+
+    void BfVM::checkWatchpoints() {
+        foreach(const Watchpoint &wp, *m_watchpoints) {
+            if(m_DP >= wp.first && m_DP <= wp.last
+                    && wp.condition.evaluate(m_memory, m_DP)) {
+                qDebug("BfVM::checkWatchpoints() cell %d written at IP %d", m_DP, m_IP);
+                emit watchpoint(m_IP, m_DP);
+                ++m_metrics.signalsEmitted;
+                // the instruction still finishes before the state machine gets to stop us
+                postStateEvent(new BreakpointEvent);
+                return;
+            }
+        }
+    }
+
+    void BfVM::emitMemoryProfile() {
+        BfMemoryProfile profile;
+        profile.reads.resize(MAX_MEM_ADDR+1);
+        profile.writes.resize(MAX_MEM_ADDR+1);
+        memcpy(profile.reads.data(), m_cellReads, (MAX_MEM_ADDR+1) * sizeof(quint64));
+        memcpy(profile.writes.data(), m_cellWrites, (MAX_MEM_ADDR+1) * sizeof(quint64));
+        profile.minDp = m_profileMinDp;
+        profile.maxDp = m_profileMaxDp;
+
+        emit memoryProfile(profile);
+        ++m_metrics.signalsEmitted;
+    }
+
+    void BfVM::clearMemoryProfile() {
+        memset(m_cellReads, 0, (MAX_MEM_ADDR+1) * sizeof(quint64));
+        memset(m_cellWrites, 0, (MAX_MEM_ADDR+1) * sizeof(quint64));
+        m_profileMinDp = MAX_MEM_ADDR;
+        m_profileMaxDp = 0;
+    }
+
+    void BfVM::postStateEvent(QEvent *e) {
+        ++m_metrics.eventsPosted;
+        m_stateMachine->postEvent(e);
+        // whatever happened, the state machine needs to handle it before we go on
+        m_yield = true;
+    }
+
+    void BfVM::execute() {
+        /* If we've reached the last instruction, post an EndEvent and let the state machine
+           handle the rest */
+        if(m_IP >= m_programSize) {
+            qDebug("BfVM::execute() program end reached");
+            postStateEvent(new EndEvent);
+            return;
+        }
+
+        // publish our position for the sampling profiler. These are plain stores
+        m_ipSlot = int(m_IP);
+        m_dpSlot = int(m_DP);
+
+        // NOTE: the IP is increased by the runInstruction() function
+        runInstruction(m_program[m_IP]);
+    }
+
+    void BfVM::runSlice() {
+        QTime slice;
+        slice.start();
+        m_yield = false;
+
+        /* checking the clock after every instruction would cost more than the
+           instructions themselves, so do it every SLICE_CHECK_INTERVAL instructions */
+        do {
+            for(int i = 0; i < SLICE_CHECK_INTERVAL && !m_yield; ++i) {
+                execute();
+            }
+        } while(!m_yield && slice.elapsed() < SLICE_LENGTH);
+
+        publishSnapshot(false);
+    }
+
+    void BfVM::publishSnapshot(bool force) {
+        if(!force && m_snapshotClock.elapsed() < 1000 / SNAPSHOT_FPS)
+            return;
+        m_snapshotClock.restart();
+
+        m_view.publish(m_IP, m_DP, m_metrics);
+
+        BfVMSnapshot snap;
+        snap.dirtyStart = m_dirtyStart;
+        snap.dirtyEnd = m_dirtyEnd;
+        snap.inputConsumed = m_inputConsumed;
+
+        // start collecting changes for the next snapshot
+        m_dirtyStart = MAX_MEM_ADDR;
+        m_dirtyEnd = 0;
+        m_inputConsumed = 0;
+
+        emit snapshot(snap);
+        ++m_metrics.signalsEmitted;
+    }
+
     void BfVM::clearMemory() {
         // note the use of <= to actually clear the memory UP to the last address...
         for(int i = 0; i <= MAX_MEM_ADDR;++i) {
@@ -507,20 +1214,126 @@ namespace QtBrain {
 
 
     Memtype BfVM::getInput() {
-        Q_ASSERT_X(!m_inputBuffer->isEmpty(), "BfVM::getInput()", "input buffer empty");
-        emit inputConsumed();
-        return m_inputBuffer->dequeue();
+        char c = 0;
+        bool ok = m_inputChannel->get(&c);
+        Q_ASSERT_X(ok, "BfVM::getInput()", "input buffer empty");
+        Q_UNUSED(ok);
+        ++m_inputConsumed;
+        ++m_metrics.inputBytes;
+        return c;
     }
 
     bool BfVM::checkInputBuffer() {
-        qDebug("BfVM::checkInputBuffer() buffer size %d",m_inputBuffer->size());
-        // If the input buffer is empty, post an event to the state machine
-        if(m_inputBuffer->isEmpty()) {
-            m_stateMachine->postEvent(new InputBufferEmptyEvent);
+        qDebug("BfVM::checkInputBuffer() buffer size %d",m_inputChannel->available());
+        if(m_inputChannel->available() > 0 || fillInputChannel())
+            return true;
+
+        // at the end of input INP doesn't wait, unless it's been told to
+        if(m_inputEof && m_eofBehaviour != EOF_WAIT)
             return false;
+
+        /* nothing more is coming from the device. A device that just doesn't have
+           anything yet lets us know when it does */
+        if(m_inputEof) {
+            emit inputExhausted();
+            ++m_metrics.signalsEmitted;
         }
 
-        return true;
+        // If the input buffer is empty, post an event to the state machine
+        postStateEvent(new InputBufferEmptyEvent);
+        return false;
+    }
+
+    bool BfVM::fillInputChannel() {
+        int added = 0;
+        if(!m_pendingInput.isEmpty()) {
+            const int written = m_inputChannel->write(m_pendingInput);
+            m_pendingInput.remove(0, written);
+            added += written;
+        }
+
+        // the device's data only goes in after everything given with input()
+        if(m_inputDevice == NULL || !m_pendingInput.isEmpty())
+            return added > 0;
+
+        const int space = qMin(m_inputChannel->freeSpace(), int(INPUT_CHUNK_SIZE));
+        if(space == 0)
+            return added > 0;
+
+        const qint64 got = m_inputFd >= 0 ? readInputFd(space)
+                                          : m_inputDevice->read(m_inputChunk, space);
+        if(got > 0) {
+            m_inputChannel->write(m_inputChunk, int(got));
+            added += int(got);
+        } else if(m_inputFd >= 0) {
+            // readInputFd() has already told what nothing means
+        } else if(got < 0 || !m_inputDevice->isSequential()) {
+            /* files are at their end when they have nothing to give. Other sequential
+               devices may just not have anything right now, and tell us when they're
+               done with readChannelFinished() */
+            m_inputEof = true;
+        }
+        qDebug("BfVM::fillInputChannel() %d bytes", added);
+        return added > 0;
+    }
+
+    qint64 BfVM::readInputFd(int max) {
+#ifdef Q_OS_UNIX
+        pollfd pfd = {m_inputFd, POLLIN, 0};
+        if(::poll(&pfd, 1, 0) <= 0) {
+            // nothing yet. Wake up when there is
+            m_inputNotifier->setEnabled(true);
+            return 0;
+        }
+
+        ssize_t got;
+        do {
+            got = ::read(m_inputFd, m_inputChunk, max);
+        } while(got < 0 && errno == EINTR);
+
+        // only a read that returns nothing is the end of input
+        if(got <= 0) {
+            if(got < 0)
+                qWarning("BfVM::readInputFd() %s", strerror(errno));
+            m_inputEof = true;
+            return 0;
+        }
+        return got;
+#else
+        Q_UNUSED(max);
+        return 0;
+#endif
+    }
+
+    void BfVM::flushOutput() {
+        if(m_outputBuffered == 0 || m_outputDevice == NULL)
+            return;
+        qDebug("BfVM::flushOutput() %d bytes", m_outputBuffered);
+
+        if(m_outputDevice->write(m_outputBuffer, m_outputBuffered) != m_outputBuffered)
+            qWarning() << "BfVM::flushOutput() error writing output:"
+                       << m_outputDevice->errorString();
+        m_outputBuffered = 0;
+
+        // QFile buffers too, and an interactive user wants to see the output now
+        QFile *file = qobject_cast<QFile*>(m_outputDevice);
+        if(file != NULL)
+            file->flush();
+    }
+
+    void BfVM::readEof() {
+        switch(m_eofBehaviour) {
+        case(EOF_ZERO):
+            m_memory[m_DP] = 0;
+            markDirty();
+            break;
+        case(EOF_MINUS_ONE):
+            m_memory[m_DP] = -1;
+            markDirty();
+            break;
+        default:    // EOF_UNCHANGED
+            break;
+        }
     }
 
 
@@ -533,10 +1346,12 @@ namespace QtBrain {
       */
     void BfVM::memoizeJumps() {
         QStack<IPType> jzs;
+        QVector<QPair<IPType,IPType> > pairs;
         /* scan program, push location of JZs encountered on stack. When a
            JNZ is encountered, pop a location from the stack and add the popped JZ location
-           and the IP of the JNZ to the m_jmps BiHash.*/
-        for(int i = 0; i < m_programSize; ++i) {
+           and the IP of the JNZ to the pairs. m_jmps is built from them in one go, which
+           also throws away the jumps of the previous program.*/
+        for(IPType i = 0; i < m_programSize; ++i) {
             if(m_program[i] == JZ) {
                 qDebug() << "BfVM::memoizeJumps() JZ at"<<i;
                 jzs.push(i);
@@ -547,10 +1362,11 @@ namespace QtBrain {
                 qDebug() << "BfVM::memoizeJumps() JNZ at"<<i;
                 Q_ASSERT_X(!jzs.isEmpty(), "BfVM::memoizeJumps()",
                            "JZ stack empty but found a JNZ");
-                m_jmps->insert(jzs.pop(), i);
+                pairs.append(qMakePair(jzs.pop(), i));
             }
         }
-        qDebug() << "BfVM: (JZ,JNZ)" << m_jmps->lhash();
+        m_jmps->build(pairs);
+        qDebug() << "BfVM: (JZ,JNZ)" << *m_jmps;
         Q_ASSERT_X(jzs.isEmpty(), "BfVM::memoizeJumps()",
                    "JZ stack NOT empty after scanning whole source.");
     }
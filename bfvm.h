@@ -26,14 +26,22 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QThread>
 #include <QList>
-#include <QQueue>
+#include <QVector>
+#include <QStack>
+#include <QHash>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QTime>
+#include <QIODevice>
 #include "bihash.h"
+#include "bfchannel.h"
 #include "customTransitions.h"
 
 class QStateMachine;
 class QState;
 class QTimer;
 class QHistoryState;
+class QSocketNotifier;
 namespace QtBrain {
 
     /**
@@ -59,6 +67,10 @@ namespace QtBrain {
       All slots meant for external use are marked as such.
 
       The current signal/slot situation is really confusing and obviously suboptimal.
+
+      The VM lives in its own thread, so everything between it and the GUI is either a
+      queued signal or goes through something that's safe to use from another thread:
+      the output channel, the metrics, the sampled IP/DP and the view (see BfVMView).
       */
 
 
@@ -73,6 +85,11 @@ namespace QtBrain {
     enum BfOpcode {DPINC, DPDEC, ADD, SUB, OUT, INP, JZ, JNZ, BRK, INVALID};
     //               >      <    +    -    .    ,    [   ]     %
 
+    /* what INP does when the input device has run out of data for good. EOF_WAIT treats
+       it like an empty input buffer and waits for more input, the others store
+       something in the current cell and carry on */
+    enum BfEofBehaviour {EOF_WAIT, EOF_UNCHANGED, EOF_ZERO, EOF_MINUS_ONE};
+
     /* names for the opcodes. The (char*) cast is used to get rid of the annoying
        "warning: deprecated conversion from string constant to ‘char*’ " compiler warning */
     static char* const OPCODENAMES[] = {(char*)"DPINC", (char*)"DPDEC", (char*)"ADD",
@@ -80,6 +97,235 @@ namespace QtBrain {
                                         (char*)"JNZ", (char*)"BRK", (char*)"INVALID"};
 
 
+    /**
+      Profiling data for a single [ ] loop, gathered by the VM when loop profiling is on.
+      A loop is identified by the IP of its JZ.
+
+      An "entry" is every time the JZ is executed, since the JNZ jumps to the instruction
+      AFTER the JZ when looping. An entry whose *DP is 0 skips the loop and counts as an
+      entry with 0 iterations.
+      */
+    struct LoopProfile {
+        LoopProfile() : jz(0), jnz(0), entries(0), iterations(0), maxIterations(0),
+                        instructions(0) {}
+
+        IPType  jz;                 // IP of the loop's JZ
+        IPType  jnz;                // IP of the matching JNZ
+        quint64 entries;            // how many times the loop was entered
+        quint64 iterations;         // how many times the loop body was run in total
+        quint64 maxIterations;      // the most iterations done during a single entry
+        quint64 instructions;       /* instructions retired while inside the loop,
+                                       including nested loops and the JZ/JNZ themselves */
+    };
+
+
+
+    /**
+      Memory access profile of a program, gathered by the VM when memory profiling is on.
+
+      ADD and SUB read and write their cell, OUT, JZ and JNZ read it and INP writes it
+      when it stores something. The DP range is the lowest and highest cell any
+      instruction was run on. It doesn't know about the DP wrapping around, so a program
+      that steps left from cell 0 has used the whole tape as far as it's concerned.
+      */
+    struct BfMemoryProfile {
+        BfMemoryProfile() : minDp(1), maxDp(0) {}
+
+        QVector<quint64> reads;     // per cell
+        QVector<quint64> writes;    // per cell
+        DPType  minDp;              /* the range of the DP while profiling, inclusive.
+                                       minDp > maxDp if nothing was run */
+        DPType  maxDp;
+
+        bool isEmpty() const { return minDp > maxDp; }
+        int span() const { return isEmpty() ? 0 : maxDp - minDp + 1; }
+        int cellsTouched() const;       // cells read or written at least once
+        QList<DPType> hottest(int count) const;
+                                        /* the count most accessed cells, most accessed
+                                           first. Cells that weren't accessed aren't
+                                           included */
+
+        QString toJson(int hottestCount = 16) const;
+    };
+
+
+    /**
+      The condition of a breakpoint, like "*DP == 10 && mem[42] != 0".
+
+      A condition is one or more comparisons joined with &&. The operands are DP, *DP
+      (the cell at the DP), mem[N] (cell N) and integer constants, and the comparisons
+      are ==, !=, <, <=, > and >=. Cells are signed, as in the memory view. The names are
+      case insensitive.
+
+      The text is parsed once into a list of comparisons, so the VM doesn't have to do
+      more than a few loads and compares each time the breakpoint is reached. An empty
+      condition is always true.
+      */
+    class BfCondition {
+    public:
+        BfCondition() : m_valid(true) {}
+
+        // parses text. On error the condition is invalid and *error says why
+        static BfCondition parse(const QString &text, QString *error = 0);
+
+        bool isValid() const { return m_valid; }
+        bool isAlways() const { return m_terms.isEmpty(); }
+        QString text() const { return m_text; }
+
+        bool evaluate(const Memtype *memory, DPType dp) const {
+            for(int i = 0; i < m_terms.size(); ++i) {
+                if(!m_terms[i].evaluate(memory, dp))
+                    return false;
+            }
+            return true;
+        }
+
+    protected:
+        enum OperandKind {CONSTANT, DP_VALUE, CELL_AT_DP, CELL};
+        enum Comparison {EQ, NE, LT, LE, GT, GE};
+
+        struct Operand {
+            OperandKind kind;
+            int         value;      // the constant or the address of the cell
+
+            int evaluate(const Memtype *memory, DPType dp) const {
+                switch(kind) {
+                case DP_VALUE:   return dp;
+                case CELL_AT_DP: return memory[dp];
+                case CELL:       return memory[value];
+                default:         return value;
+                }
+            }
+        };
+
+        struct Term {
+            Operand     left;
+            Comparison  comparison;
+            Operand     right;
+
+            bool evaluate(const Memtype *memory, DPType dp) const {
+                const int l = left.evaluate(memory, dp), r = right.evaluate(memory, dp);
+                switch(comparison) {
+                case EQ: return l == r;
+                case NE: return l != r;
+                case LT: return l < r;
+                case LE: return l <= r;
+                case GT: return l > r;
+                default: return l >= r;
+                }
+            }
+        };
+
+        static bool parseOperand(const QString &text, Operand *operand);
+
+        QVector<Term>   m_terms;    // all have to be true
+        QString         m_text;
+        bool            m_valid;
+    };
+
+
+    /**
+      A breakpoint set with BfVM::setBreakpoint(). Each time the VM reaches it and the
+      condition is true counts as a hit. If hitCount is set, the VM only stops on that
+      hit, so "stop on the millionth time" never leaves the VM until it happens. The
+      hits are counted from zero again when the VM is reset.
+      */
+    struct BfBreakpoint {
+        BfBreakpoint() : hitCount(0) {}
+
+        BfCondition condition;
+        quint64     hitCount;       // the hit to stop on, 0 stops on every hit
+    };
+
+
+    /**
+      Runtime counters of the VM, see BfVM::metrics().
+
+      The counters are only ever written by the VM's thread, and are reset along with
+      the VM. Other threads never read the live counters: the VM publishes a copy
+      through its view (see BfVMView) with every snapshot, so they see values at most
+      1/SNAPSHOT_FPS s old, and a quint64 can't be torn even on 32 bit platforms. The
+      VM pays no more than an increment per counter.
+      */
+    struct BfVMMetrics {
+        BfVMMetrics();
+
+        quint64 instructions;       // instructions retired in total
+        quint64 retired[INVALID];   // instructions retired, per opcode
+        quint64 branchesTaken;      // JZs and JNZs that actually jumped
+        quint64 inputBytes;         // bytes consumed by INP
+        quint64 outputBytes;        // bytes produced by OUT
+        quint64 eventsPosted;       // events posted to the VM's state machine
+        quint64 signalsEmitted;     // Qt signals emitted while executing instructions
+
+        QString toJson() const;     // the counters as a JSON object
+    };
+
+
+    /**
+      What changed in the VM since the last snapshot.
+
+      Instead of signalling every change to the IP, DP and memory as it happens, the VM
+      publishes one of these after every single step, and at most SNAPSHOT_FPS times a
+      second while running. It only tells what to look at: the cells and registers
+      themselves are read from the VM's view (see BfVMView), so nothing is copied.
+      */
+    struct BfVMSnapshot {
+        BfVMSnapshot() : dirtyStart(1), dirtyEnd(0), inputConsumed(0) {}
+
+        DPType      dirtyStart;     /* the range of memory written to since the last
+                                       snapshot, inclusive. dirtyStart > dirtyEnd if
+                                       nothing was written */
+        DPType      dirtyEnd;
+        quint32     inputConsumed;  // bytes read from the input buffer since the last one
+
+        bool isDirty() const { return dirtyStart <= dirtyEnd; }
+    };
+
+
+    /**
+      Read-only access to the VM's memory, registers and metrics from other threads.
+
+      The cells are the VM's own memory array. A cell is a single byte so a read can't be
+      torn, but it may already see writes that the last snapshot didn't report yet.
+
+      The IP, DP and metrics are published by the VM along with every snapshot, under a
+      sequence lock: the VM makes the sequence odd, writes them and makes it even
+      again, and a reader retries until it gets the same even sequence before and
+      after reading. So registers() always returns a pair that belongs together,
+      metrics() never returns a half written counter, and the VM never waits for a
+      reader. Half the sequence is the publication's epoch.
+      */
+    class BfVMView {
+    public:
+        BfVMView(const Memtype *cells, int size);
+
+        const Memtype *cells() const { return m_cells; }
+        int size() const { return m_size; }
+
+        /* the registers as last published, and the epoch they were published in.
+           Safe to call from any thread */
+        quint32 registers(IPType *ip, DPType *dp) const;
+
+        // the metrics as last published. Safe to call from any thread
+        BfVMMetrics metrics() const;
+
+    private:
+        friend class BfVM;
+        // only ever called by the VM's thread
+        void publish(IPType ip, DPType dp, const BfVMMetrics &metrics);
+
+        int beginRead() const;              // waits out a write, returns the sequence
+        bool endRead(int sequence) const;   // true if nothing was written meanwhile
+
+        const Memtype       *m_cells;
+        int                 m_size;
+        mutable QAtomicInt  m_sequence;     // odd while the VM is writing the registers
+        IPType              m_ip;
+        DPType              m_dp;
+        BfVMMetrics         m_metrics;
+    };
+
 
     class BfVM : public QThread
     {
@@ -88,9 +334,45 @@ namespace QtBrain {
         /////////////////////////////////////////////////////////////////////////////////////
         //// PUBLIC METHODS
         ///////////////////
-        explicit BfVM(QObject *parent);
+        explicit BfVM(QObject *parent = 0);/* the VM moves itself to its own thread,
+                                              and objects with a parent can't be moved.
+                                              So parent has to be 0 */
         ~BfVM();
 
+        /* the VM's input and output. The INP command reads from the input channel, which
+           the VM fills itself from input() and the input device, so nobody else may
+           write to it. OUT writes to the output channel, which has to be read by
+           whoever is interested in the output, from ONE thread. */
+        BfByteChannel *inputChannel() const { return m_inputChannel; }
+        BfByteChannel *outputChannel() const { return m_outputChannel; }
+
+        /* makes the VM read its input from device, in addition to whatever is given
+           with input(). The device is read in chunks whenever the input buffer runs
+           dry. device must be open and must not have a parent: it is moved to the VM's
+           thread and the VM takes ownership of it. 0 stops reading from a device.
+           Call from the thread device currently lives in. */
+        void setInputDevice(QIODevice *device);
+
+        /* makes the VM write its output to device instead of the output channel. The
+           output is collected in a buffer of OUTPUT_BUFFER_SIZE bytes and written out
+           when the buffer is full, before every INP, and when the VM stops or the
+           program ends. The same rules as for setInputDevice() apply. */
+        void setOutputDevice(QIODevice *device);
+
+        /* The IP and DP as last published by the VM. These are safe to call from any
+           thread and are meant for the sampling profiler (see BfSampler). The two values
+           are published separately, so a sample may pair an IP with the DP of the
+           previous instruction. */
+        IPType sampledIP() const { return IPType(int(m_ipSlot)); }
+        DPType sampledDP() const { return DPType(int(m_dpSlot)); }
+
+        /* a copy of the VM's runtime counters as of the last snapshot. Safe to call
+           from any thread, see BfVMMetrics */
+        BfVMMetrics metrics() const { return m_view.metrics(); }
+
+        // the VM's memory and registers, for reading from other threads
+        const BfVMView *view() const { return &m_view; }
+
         /////////////////////////////////////////////////////////////////////////////////////
         //// PUBLIC MEMBERS
         ///////////////////
@@ -108,6 +390,17 @@ namespace QtBrain {
                                               NOTE: If you change DPType, make sure that
                                               m_maxAddress is calculated properly */
 
+        static const IPType NO_BREAKPOINT = 0-1;
+
+        static const int SNAPSHOT_FPS = 60; /* the most snapshots a second the VM will
+                                               publish while running */
+
+        static const int INPUT_CHANNEL_SIZE = 1 << 16;
+        static const int INPUT_CHUNK_SIZE = 1 << 16;/* the most bytes read from the
+                                                       input device at a time */
+        static const int OUTPUT_CHANNEL_SIZE = 1 << 20;
+        static const int OUTPUT_BUFFER_SIZE = 1 << 20;
+
 
 
         /////////////////////////////////////////////////////////////////////////////////////
@@ -117,18 +410,17 @@ namespace QtBrain {
            Combine signals by using default arguments, maybe? */
     signals:
 
-        void DPChanged(DPType);              /* emitted when the DP changes */
-
-        void memChanged(DPType, Memtype);    /* emitted when memory changes. */
-
-        void heartBeat(const IPType&);       /* emitted whenever a step() is done. The IP
-                                               is sent as an argument */
-
-
-        void output(const Memtype&);        /* the OUT command emits data with this */
+        void snapshot(const BfVMSnapshot&); /* the state of the VM, emitted after every
+                                               single step and at most SNAPSHOT_FPS
+                                               times a second while running */
 
         void needInput();                   /* emitted when the input buffer is empty */
 
+        void inputExhausted();              /* emitted when INP waits even though the
+                                               input device has run out for good, ie.
+                                               with EOF_WAIT. Only input() can get the
+                                               VM going again */
+
 
         void running(bool);                 /* emitted when changing running states*/
 
@@ -141,10 +433,18 @@ namespace QtBrain {
         void resetted();                    /* emitted when the VM has been reset */
         void cleared();                     /* emitted when the VM has been cleared */
 
-        void inputConsumed();               /* emitted whenever the VM consumes from the
-                                               input buffer */
-
         void breakpoint(IPType, DPType);    /* emitted when a breakpoint is reached */
+        void watchpoint(IPType, DPType);    /* emitted when the instruction at the IP
+                                               wrote to a watched cell. The VM stops
+                                               right after the instruction */
+
+        void loopProfile(const QList<LoopProfile>&);
+                                            /* emitted with the loop profile gathered so
+                                               far when the VM stops running or finishes,
+                                               if loop profiling is on */
+        void memoryProfile(const BfMemoryProfile&);
+                                            /* the same for the memory profile, if
+                                               memory profiling is on */
 
 
         /////////////////////////////////////////////////////////////////////////////////////
@@ -168,7 +468,7 @@ namespace QtBrain {
         IPType             m_IP;            /* Instruction Pointer. Points to the
                                             command being executed */
 
-        DPType             m_programSize;   /* the size of the Brainfuck program currently
+        IPType             m_programSize;   /* the size of the Brainfuck program currently
                                             loaded */
 
 
@@ -176,7 +476,9 @@ namespace QtBrain {
 
 
         qint32             m_runDelay;      /* the delay between steps when running a
-                                            Brainfuck program. Defaults to 500ms*/
+                                            Brainfuck program. Defaults to 500ms.
+                                            0 runs the program at full speed, in
+                                            slices of SLICE_LENGTH ms */
 
         Memtype            *m_memory;       /* the memory array. Needs to be the same size
                                             as the DP, ie. with a 16 bit DP you can
@@ -198,13 +500,133 @@ namespace QtBrain {
         QTimer             *m_runTimer;     /* times the delay between steps when
                                             running a Bf program */
 
-        QQueue<Memtype>    *m_inputBuffer;  /* buffer for input characters. The INP
+        BfByteChannel      *m_inputChannel; /* buffer for input characters. The INP
                                                command reads from this, and if it is empty
                                                a needInput() signal is emitted.
                                                Input data can be given with the input()
-                                               slot */
-
-        QList<IPType>      *m_breakpoints;  /* a list of breakpoints */
+                                               slot or from an input device. Both are
+                                               written in the VM's thread, so this one
+                                               never crosses threads */
+
+        QByteArray         m_pendingInput;  /* input() data that didn't fit in the input
+                                               channel. Goes in before the input device's
+                                               data */
+
+        QIODevice          *m_inputDevice;  // see setInputDevice(). NULL if none
+        int                m_inputFd;       /* the file descriptor of a pipe or terminal
+                                               input device, -1 otherwise. These are
+                                               read straight from the descriptor, see
+                                               fillInputChannel() */
+        QSocketNotifier    *m_inputNotifier;/* tells when m_inputFd has something to
+                                               read. Only enabled while INP is waiting */
+        char               *m_inputChunk;   // INPUT_CHUNK_SIZE bytes for reading the device
+        bool               m_inputEof;      /* set when the input device has no more data
+                                               to give, ever */
+        BfEofBehaviour     m_eofBehaviour;  // what INP does after m_inputEof is set
+
+        BfByteChannel      *m_outputChannel;/* the OUT command writes here. If it's full,
+                                               the VM waits up to OUTPUT_WAIT ms for it
+                                               to be read before giving up until the
+                                               next tick */
+
+        static const int   OUTPUT_WAIT = 20;
+
+        QIODevice          *m_outputDevice; // see setOutputDevice(). NULL if none
+        char               *m_outputBuffer; /* OUTPUT_BUFFER_SIZE bytes of output waiting
+                                               to be written to m_outputDevice */
+        int                m_outputBuffered;// bytes in m_outputBuffer
+
+        // a breakpoint set with setBreakpoint(), see m_breakpoints
+        struct PatchedBreakpoint {
+            BfOpcode        replaced;       // the instruction the BRK replaced
+            BfBreakpoint    breakpoint;
+            quint64         hits;           // since the last reset
+        };
+
+        QHash<IPType, PatchedBreakpoint> *m_breakpoints;
+                                            /* the breakpoints set with setBreakpoint(),
+                                               by IP. The program has a BRK at each of
+                                               these IPs, so nothing but BRK ever looks
+                                               for them and a program without breakpoints
+                                               pays nothing. Conditions and hit counts are
+                                               checked right there, without a trip
+                                               through the state machine */
+        // cells to stop on writes to, see addWatchpoint()
+        struct Watchpoint {
+            DPType          first;
+            DPType          last;
+            BfCondition     condition;
+        };
+
+        QList<Watchpoint>  *m_watchpoints;
+        bool               m_watching;      // true if there are any watchpoints
+        bool               *m_watched;      /* MAX_MEM_ADDR+1 flags, set for the cells
+                                               some watchpoint covers. Writes only look
+                                               further if m_watching is set and the
+                                               cell's flag is */
+
+        IPType             m_resumeIP;      /* the breakpoint the VM last stopped at. When
+                                               it carries on, the instruction under the
+                                               breakpoint is run instead of stopping
+                                               again. NO_BREAKPOINT if none */
+
+        bool               m_loopProfiling; // true if loop profiling is on
+
+        BfVMMetrics        m_metrics;       /* runtime counters. Cleared whenever the VM
+                                               is reset. Only the VM's thread touches
+                                               these, others read m_view's copy */
+
+        QHash<IPType, LoopProfile> *m_loopProfile;
+                                            /* per-loop profiling data, keyed by the IP
+                                               of the loop's JZ */
+
+        /* a loop currently being executed. Used by the loop profiler to count the
+           iterations and instructions of the current entry */
+        struct ActiveLoop {
+            IPType  jz;
+            quint64 iterations;
+            quint64 retiredAtEntry;
+        };
+
+        QStack<ActiveLoop> *m_activeLoops;  /* the loops the IP is currently inside,
+                                               innermost on top */
+
+        bool               m_memoryProfiling;// true if memory profiling is on
+        quint64            *m_cellReads;    /* per cell access counts for the memory
+                                               profile, MAX_MEM_ADDR+1 of each */
+        quint64            *m_cellWrites;
+        DPType             m_profileMinDp;  // the DP range, see BfMemoryProfile
+        DPType             m_profileMaxDp;
+        bool               m_profilesEmitted;/* true if the profiles have been emitted
+                                               since the VM last ran. stop() runs for
+                                               both the running state and the run group,
+                                               and only the first one emits them */
+
+        QAtomicInt         m_ipSlot;        /* the IP and DP, published before each
+                                               instruction for the sampling profiler to
+                                               read from its own thread. Only the VM
+                                               writes to these */
+        QAtomicInt         m_dpSlot;
+
+        static const int   SLICE_LENGTH = 20;
+                                            /* how long a full speed run slice lasts in
+                                               ms before the event loop gets to run */
+        static const int   SLICE_CHECK_INTERVAL = 4096;
+                                            /* instructions run between checks of the
+                                               clock during a run slice */
+
+        bool               m_yield;         /* set when an event is posted to the state
+                                               machine, so a run slice stops and lets
+                                               the state machine handle it */
+
+        BfVMView           m_view;          // see view()
+
+        QTime              m_snapshotClock; // time since the last snapshot
+        DPType             m_dirtyStart;    /* the range of memory written to since the
+                                               last snapshot, see BfVMSnapshot */
+        DPType             m_dirtyEnd;
+        quint32            m_inputConsumed; /* bytes read from the input buffer since
+                                               the last snapshot */
 
 
 
@@ -241,7 +663,7 @@ namespace QtBrain {
 
         void listStates() const;
 
-        void run();                       // QThread
+        void run();                       // QThread. Runs the VM's event loop
 
 
         void memoizeJumps();              /* goes through the program and stores all
@@ -261,8 +683,66 @@ namespace QtBrain {
                                              returns true. If it is, returns false and
                                              posts an InputBufferEmptyEvent to the state
                                              machine */
-        Memtype getInput();               /* dequeues one character from the input buffer.
-                                             Also emits a inputConsumed() signal */
+        Memtype getInput();               /* dequeues one character from the input
+                                             buffer */
+
+        bool fillInputChannel();          /* moves pending input and then data from the
+                                             input device into the input channel, as much
+                                             as fits. Returns true if anything was added */
+        qint64 readInputFd(int max);      /* reads what m_inputFd has right now, at most
+                                             max bytes, into m_inputChunk. Sets m_inputEof
+                                             at the end of input */
+
+        void readEof();                   // INP at the end of input, see BfEofBehaviour
+
+        void flushOutput();               /* writes the output buffer to the output
+                                             device, if there is one */
+
+        void execute();                   /* runs the instruction at the IP, or posts an
+                                             EndEvent if the program has ended */
+
+        void runSlice();                  /* runs the program at full speed for
+                                             SLICE_LENGTH ms, or until an event is
+                                             posted to the state machine */
+
+        void publishSnapshot(bool force); /* emits a snapshot() if it's been long enough
+                                             since the last one, or if force is set */
+
+        /* widens the dirty memory range to include the cell at the DP. Every write to
+           memory goes through here, so it's where the memory profile counts them */
+        void markDirty() {
+            if(m_memoryProfiling)
+                ++m_cellWrites[m_DP];
+            if(m_watching && m_watched[m_DP])
+                checkWatchpoints();
+            if(m_DP < m_dirtyStart)
+                m_dirtyStart = m_DP;
+            if(m_DP > m_dirtyEnd)
+                m_dirtyEnd = m_DP;
+        }
+
+        void postStateEvent(QEvent*);     /* posts an event to the state machine and
+                                             counts it */
+
+        void profileLoop(const BfOpcode&);/* updates the loop profile for a JZ or JNZ
+                                             about to be executed at the current IP */
+
+        void emitLoopProfile();           /* emits loopProfile() with the current loop
+                                             profile. Loops that are still being
+                                             executed are included as they stand */
+
+        void profileMemory(const BfOpcode&);/* counts the read and the DP of an
+                                               instruction that has just been retired.
+                                               Writes are counted by markDirty() */
+
+        void emitMemoryProfile();         // emits memoryProfile()
+
+        void runReplaced(BfOpcode op);    /* runs the instruction a breakpoint at the IP
+                                             replaced, without stopping */
+
+        void checkWatchpoints();          /* stops the VM if a watchpoint's condition is
+                                             true for the cell just written at the DP */
+        void clearMemoryProfile();
 
 
 
@@ -273,6 +753,9 @@ namespace QtBrain {
         void step();        /* runs the instruction pointed to by the IP and then increments
                             the IP */
 
+        void tick();        /* run timer tick. Steps once, or runs a whole slice if there's
+                               no delay between steps */
+
         void go();          /* puts the state machine in the running state.
                                Starts a timer that repeatedly triggers step()*/
 
@@ -288,6 +771,14 @@ namespace QtBrain {
         // TEST. Ignore.
         void breakPtTest();
 
+        void changeInputDevice(QIODevice *device);  // the VM thread's half of
+                                                    // setInputDevice()
+        void inputDeviceReadyRead();    // new data from a sequential input device
+        void inputFdReadable();         // the same for m_inputFd
+        void inputDeviceFinished();     // the input device won't send anything anymore
+        void changeOutputDevice(QIODevice *device); // the VM thread's half of
+                                                    // setOutputDevice()
+
 
         /////////////////////////////////////////////////////////////////////////////////////
         //// SLOTS FOR EXTERNAL USE
@@ -297,14 +788,37 @@ namespace QtBrain {
 
         void initialize(const QList<BfOpcode>&);
 
-        void input(const QString &in);  /* sets the input buffer contents.
-                                           Currently RESETS the input buffer contents
-                                           instead of appending. FIXME... */
+        void input(const QString &in);  /* appends to the input buffer contents */
+
+        void setEofBehaviour(BfEofBehaviour eof);
+                                        /* sets what INP does when the input device is
+                                           exhausted. Defaults to EOF_WAIT */
 
         void setBreakpoint(IPType pos); /* sets a breakpoint at the specified IP. The
                                            breakpoint will be triggered when the IP ==
                                            pos, but before the command at that IP is
-                                           executed */
+                                           executed. Loading a program clears all
+                                           breakpoints */
+        void setBreakpoint(IPType pos, const BfBreakpoint &bp);
+                                        /* the same with a condition and a hit count.
+                                           Setting a breakpoint again replaces it and
+                                           starts counting its hits from zero */
+        void clearBreakpoint(IPType pos);
+        void clearBreakpoints();
+
+        void addWatchpoint(DPType first, DPType last, const BfCondition &condition);
+                                        /* stops the VM after an instruction writes to
+                                           any of the cells first..last (inclusive), if
+                                           the condition is true after the write. The
+                                           condition's *DP is the written cell.
+                                           Watchpoints stay until cleared */
+        void clearWatchpoints();
+
+        void setLoopProfiling(bool on); /* turns loop profiling on or off. The profile
+                                           is cleared whenever the VM is reset */
+
+        void setMemoryProfiling(bool on);/* the same for memory profiling. Turning it off
+                                            keeps the counts gathered so far */
 
 
 
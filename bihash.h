@@ -23,26 +23,60 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #ifndef BIHASH_H
 #define BIHASH_H
+#include <QVector>
+#include <QPair>
 #include <QHash>
-#include <QList>
+#include <QtAlgorithms>
+#include <QDebug>
+#include <climits>
 
 namespace QtBrain {
 
     /**
       This is a bidirectional hash which makes lookup by key and by value much easier.
-      Instead of doing O(n) key lookups using QHash::keys(), two QHashes are used to
-      store the values. This way the speed of looking up by either "side" of the hash is
-      the same as QHash's amortized O(1).
+      Looking up by either "side" of the hash is amortized O(1).
 
       This particular implementation requires that all keys and values be unique, so storing
       something like (5,7) and (7,2) won't work.
+
+      The (key, value) pairs are stored next to each other in one QVector, and two open
+      addressing tables (linear probing) hold the indexes of the pairs by key and by value.
+      A lookup is a hash and a short scan over an int array instead of following the
+      nodes of a QHash. Iterating goes straight through the pairs, in insertion order as
+      long as nothing has been replaced.
+
+      BiHash<quint32,quint32> is specialized below for keys and values which are small
+      dense integers, like the IPs in the jump tables.
       */
 
     template <typename K, typename V>
             class BiHash
     {
     public:
-        BiHash()  {}
+        typedef QPair<K,V> Entry;
+
+        /**
+          Iterates over the (key, value) pairs without copying anything. Works like
+          QHash::const_iterator.
+          */
+        class const_iterator {
+        public:
+            const_iterator() : m_entry(NULL) {}
+            explicit const_iterator(const Entry *entry) : m_entry(entry) {}
+
+            const K &key() const   { return m_entry->first; }
+            const V &value() const { return m_entry->second; }
+
+            const_iterator &operator++() { ++m_entry; return *this; }
+            const_iterator operator++(int) { const_iterator old = *this; ++m_entry; return old; }
+            bool operator==(const const_iterator &o) const { return m_entry == o.m_entry; }
+            bool operator!=(const const_iterator &o) const { return m_entry != o.m_entry; }
+
+        private:
+            const Entry *m_entry;
+        };
+
+        BiHash() : m_mask(0), m_shift(32) {}
 
         ~BiHash() {
         }
@@ -51,35 +85,42 @@ namespace QtBrain {
           "standard" QHash value lookup, ie. looks up a value associated with a key
           */
         const V value(const K &k) const{
-            return m_lhash.value(k);
+            const int e = find<LeftSide>(m_left, k);
+            return e == EMPTY ? V() : m_entries.at(e).second;
         }
         /**
           looks up the key associated with the value.
           */
-        const K key(const V &k) const {
-            return m_rhash.value(k);
+        const K key(const V &v) const {
+            const int e = find<RightSide>(m_right, v);
+            return e == EMPTY ? K() : m_entries.at(e).first;
         }
 
         /**
           returns true if the BiHash contains the key k
           */
         bool containsKey(const K &k) const {
-            return m_lhash.contains(k);
+            return find<LeftSide>(m_left, k) != EMPTY;
         }
 
-
         /**
-          returns the "left" QHash, ie. the one with "<Key,Value>" mapping
+          returns true if the BiHash contains the value v
           */
-        const QHash<K,V> lhash() const  {
-            return m_lhash;
+        bool containsValue(const V &v) const {
+            return find<RightSide>(m_right, v) != EMPTY;
         }
 
+        const_iterator begin() const      { return const_iterator(m_entries.constData()); }
+        const_iterator end() const        { return const_iterator(m_entries.constData()
+                                                                  + m_entries.size()); }
+        const_iterator constBegin() const { return begin(); }
+        const_iterator constEnd() const   { return end(); }
+
         /**
-          returns the "right" QHash, ie. the one with "<Value,Key>" mapping
+          returns the (key, value) pairs. No copy is made.
           */
-        const QHash<V,K> rhash() const {
-            return m_rhash;
+        const QVector<Entry> &entries() const {
+            return m_entries;
         }
 
         /**
@@ -89,53 +130,390 @@ namespace QtBrain {
           */
         void insert(const K &k, const V &v) {
 
-            /* if the key is in the "left" hash, remove it from the both the "left"
-               AND the "right" hashes.
-               For example if (15,7) had been inserted, the hashes would contain:
-               lhash: (15,7)
-               rhash: (7,15)
-               trying to insert (15,9) would cause a collision since 15 is already "mapped
-               to" 7. All keys and values containing 15 must be removed.
-               */
-            if(m_lhash.contains(k)) {
-                m_rhash.remove(m_lhash.value(k));
-                m_lhash.remove(k);
-            }
+            /* if the key is already in the hash, the whole pair it belongs to is removed.
+               For example if (15,7) had been inserted, trying to insert (15,9) would cause
+               a collision since 15 is already "mapped to" 7. The same goes for the value:
+               inserting (1,7) would remove (15,7) too. */
+            int e = find<LeftSide>(m_left, k);
+            if(e != EMPTY)
+                removeEntry(e);
+            e = find<RightSide>(m_right, v);
+            if(e != EMPTY)
+                removeEntry(e);
 
-            /* the same applies to the "right" hash.
-               Example:
-               (15,7) inserted
-               lhash: (15,7)
-               rhash: (7,15)
-               trying to insert (1,7) causes a collision and all keys and values that contain
-               7 have to be removed.
-               */
-
-            if(m_rhash.contains(v)) {
-                m_lhash.remove(m_rhash.value(v));
-                m_rhash.remove(v);
-            }
+            if(2 * (m_entries.size() + 1) > m_left.size())
+                rehash(tableSizeFor(m_entries.size() + 1));
 
-            m_lhash.insert(k,v);
-            m_rhash.insert(v,k);
-            Q_ASSERT_X(m_lhash.size() == m_rhash.size(), "BiHash::insert()",
-                       "hash sizes don't match");
+            e = m_entries.size();
+            m_entries.append(Entry(k, v));
+            m_left[slot<LeftSide>(m_left, k)] = e;
+            m_right[slot<RightSide>(m_right, v)] = e;
+        }
+
+        /**
+          Replaces the contents with the given pairs, which must all have unique keys and
+          values. The pairs are taken over without copying them, and pairs is left empty.
+          This is much faster than inserting the pairs one at a time.
+          */
+        void build(QVector<Entry> &pairs) {
+            // the data is shared for a moment, but pairs lets go of it before any write
+            m_entries = pairs;
+            pairs.clear();
+            m_left.clear();
+            m_right.clear();
+            rehash(tableSizeFor(m_entries.size()));
+        }
+
+        /**
+          Makes room for n pairs so that no rehashing is done while they are inserted.
+          */
+        void reserve(int n) {
+            m_entries.reserve(n);
+            if(2 * n > m_left.size())
+                rehash(tableSizeFor(n));
+        }
+
+        /**
+          Swaps the contents of two BiHashes in constant time.
+          */
+        void swap(BiHash &other) {
+            qSwap(m_entries, other.m_entries);
+            qSwap(m_left, other.m_left);
+            qSwap(m_right, other.m_right);
+            qSwap(m_mask, other.m_mask);
+            qSwap(m_shift, other.m_shift);
+        }
+
+        int size() const {
+            return m_entries.size();
         }
 
         /**
           Returns true if the BiHash is empty, false otherwise.
           */
         bool isEmpty() const {
-            // No need to check both hashes since they're symmetrical anyhow.
-            return m_lhash.isEmpty();
+            return m_entries.isEmpty();
+        }
+
+        /**
+          Removes everything from the BiHash.
+          */
+        void clear() {
+            m_entries.clear();
+            m_left.clear();
+            m_right.clear();
+            m_mask = 0;
+            m_shift = 32;
         }
 
 
 
     protected:
-        QHash<K,V> m_lhash;
-        QHash<V,K> m_rhash;
+        static const int EMPTY = -1;            // unused slot in a table
+        static const int MIN_TABLE_SIZE = 16;
+
+        // which half of the pair a table is indexed by
+        struct LeftSide {
+            typedef K Type;
+            static const K &get(const Entry &e) { return e.first; }
+        };
+        struct RightSide {
+            typedef V Type;
+            static const V &get(const Entry &e) { return e.second; }
+        };
+
+        /**
+          the first slot to look at for the hash h. Fibonacci hashing spreads sequential
+          integers (which qHash() returns as they are) over the whole table.
+          */
+        int bucket(uint h) const {
+            return int((h * 2654435769u) >> m_shift) & m_mask;
+        }
+
+        static int tableSizeFor(int n) {
+            // the tables are kept at most half full
+            int size = MIN_TABLE_SIZE;
+            while(size < 2 * n)
+                size *= 2;
+            return size;
+        }
+
+        /**
+          returns the slot which holds x, or the empty slot where x would go
+          */
+        template <typename S>
+                int slot(const QVector<int> &table, const typename S::Type &x) const {
+            const int *t = table.constData();
+            int i = bucket(qHash(x));
+            while(t[i] != EMPTY && !(S::get(m_entries.at(t[i])) == x))
+                i = (i + 1) & m_mask;
+            return i;
+        }
+
+        /**
+          returns the index of the pair which holds x, or EMPTY
+          */
+        template <typename S>
+                int find(const QVector<int> &table, const typename S::Type &x) const {
+            if(table.isEmpty())
+                return EMPTY;
+            return table.at(slot<S>(table, x));
+        }
+
+        /**
+          empties slot i and moves the following pairs of the same cluster back so that
+          none of them is cut off from its bucket (backward shift deletion)
+          */
+        template <typename S>
+                void removeSlot(QVector<int> &table, int i) {
+            int j = i;
+            for(;;) {
+                j = (j + 1) & m_mask;
+                if(table[j] == EMPTY)
+                    break;
+                const int home = bucket(qHash(S::get(m_entries.at(table[j]))));
+                // the pair at j can stay if its bucket is cyclically in (i, j]
+                if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+                    continue;
+                table[i] = table[j];
+                i = j;
+            }
+            table[i] = EMPTY;
+        }
+
+        /**
+          removes the pair at index e. The last pair is moved into its place so the pairs
+          stay contiguous.
+          */
+        void removeEntry(int e) {
+            removeSlot<LeftSide>(m_left, slot<LeftSide>(m_left, m_entries.at(e).first));
+            removeSlot<RightSide>(m_right, slot<RightSide>(m_right, m_entries.at(e).second));
+
+            const int last = m_entries.size() - 1;
+            if(e != last) {
+                // the slots still point at last, which holds the same key and value
+                m_entries[e] = m_entries.at(last);
+                m_left[slot<LeftSide>(m_left, m_entries.at(e).first)] = e;
+                m_right[slot<RightSide>(m_right, m_entries.at(e).second)] = e;
+            }
+            m_entries.resize(last);
+        }
+
+        /**
+          rebuilds both tables with the given size, which must be a power of two
+          */
+        void rehash(int tableSize) {
+            m_left.fill(int(EMPTY), tableSize);
+            m_right.fill(int(EMPTY), tableSize);
+            m_mask = tableSize - 1;
+            m_shift = 32;
+            for(int size = tableSize; size > 1; size /= 2)
+                --m_shift;
+
+            for(int e = 0; e < m_entries.size(); ++e) {
+                const int l = slot<LeftSide>(m_left, m_entries.at(e).first);
+                const int r = slot<RightSide>(m_right, m_entries.at(e).second);
+                Q_ASSERT_X(m_left.at(l) == EMPTY && m_right.at(r) == EMPTY,
+                           "BiHash::rehash()", "keys and values must be unique");
+                m_left[l] = e;
+                m_right[r] = e;
+            }
+        }
+
+        QVector<Entry>  m_entries;  // the (key, value) pairs
+        QVector<int>    m_left;     // key -> index in m_entries
+        QVector<int>    m_right;    // value -> index in m_entries
+        int             m_mask;     // table size - 1
+        int             m_shift;    // 32 - log2(table size)
     };
+
+
+    /**
+      BiHash for dense integer keys and values, ie. ones that go from 0 to some not too
+      large number, like IPs. Both directions are plain arrays indexed by the key or the
+      value, so a lookup is a single load. The arrays grow to the largest key and value
+      inserted, so this is a bad fit for sparse keys.
+      */
+    template <>
+            class BiHash<quint32,quint32>
+    {
+    public:
+        typedef QPair<quint32,quint32> Entry;
+
+        /**
+          Iterates over the (key, value) pairs in key order without copying anything.
+          */
+        class const_iterator {
+        public:
+            const_iterator() : m_base(NULL), m_cur(NULL), m_end(NULL) {}
+            const_iterator(const quint32 *base, const quint32 *cur, const quint32 *end)
+                : m_base(base), m_cur(cur), m_end(end) {
+                skipUnused();
+            }
+
+            quint32 key() const   { return quint32(m_cur - m_base); }
+            quint32 value() const { return *m_cur; }
+
+            const_iterator &operator++() { ++m_cur; skipUnused(); return *this; }
+            const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+            bool operator==(const const_iterator &o) const { return m_cur == o.m_cur; }
+            bool operator!=(const const_iterator &o) const { return m_cur != o.m_cur; }
+
+        private:
+            void skipUnused() {
+                while(m_cur != m_end && *m_cur == NONE)
+                    ++m_cur;
+            }
+
+            const quint32 *m_base;
+            const quint32 *m_cur;
+            const quint32 *m_end;
+        };
+
+        BiHash() : m_size(0) {}
+
+        ~BiHash() {
+        }
+
+        const quint32 value(quint32 k) const {
+            const quint32 v = k < quint32(m_left.size()) ? m_left.at(k) : quint32(NONE);
+            return v == NONE ? 0 : v;
+        }
+
+        const quint32 key(quint32 v) const {
+            const quint32 k = v < quint32(m_right.size()) ? m_right.at(v) : quint32(NONE);
+            return k == NONE ? 0 : k;
+        }
+
+        bool containsKey(quint32 k) const {
+            return k < quint32(m_left.size()) && m_left.at(k) != NONE;
+        }
+
+        bool containsValue(quint32 v) const {
+            return v < quint32(m_right.size()) && m_right.at(v) != NONE;
+        }
+
+        const_iterator begin() const {
+            const quint32 *base = m_left.constData();
+            return const_iterator(base, base, base + m_left.size());
+        }
+        const_iterator end() const {
+            const quint32 *base = m_left.constData();
+            return const_iterator(base, base + m_left.size(), base + m_left.size());
+        }
+        const_iterator constBegin() const { return begin(); }
+        const_iterator constEnd() const   { return end(); }
+
+        void insert(quint32 k, quint32 v) {
+            Q_ASSERT_X(k != NONE && v != NONE, "BiHash::insert()", "reserved key or value");
+            grow(m_left, k);
+            grow(m_right, v);
+
+            // remove the pairs that k and v belonged to, just like the generic BiHash
+            const quint32 oldV = m_left.at(k);
+            if(oldV != NONE) {
+                m_right[oldV] = NONE;
+                --m_size;
+            }
+            const quint32 oldK = m_right.at(v);
+            if(oldK != NONE) {
+                m_left[oldK] = NONE;
+                --m_size;
+            }
+
+            m_left[k] = v;
+            m_right[v] = k;
+            ++m_size;
+        }
+
+        /**
+          Replaces the contents with the given pairs, which must all have unique keys and
+          values. pairs is left empty.
+          */
+        void build(QVector<Entry> &pairs) {
+            quint32 maxK = 0, maxV = 0;
+            for(int i = 0; i < pairs.size(); ++i) {
+                maxK = qMax(maxK, pairs.at(i).first);
+                maxV = qMax(maxV, pairs.at(i).second);
+            }
+            clear();
+            if(!pairs.isEmpty()) {
+                m_left.fill(quint32(NONE), int(maxK) + 1);
+                m_right.fill(quint32(NONE), int(maxV) + 1);
+            }
+            quint32 *left = m_left.data();
+            quint32 *right = m_right.data();
+            for(int i = 0; i < pairs.size(); ++i) {
+                const Entry &p = pairs.at(i);
+                Q_ASSERT_X(left[p.first] == NONE && right[p.second] == NONE,
+                           "BiHash::build()", "keys and values must be unique");
+                left[p.first] = p.second;
+                right[p.second] = p.first;
+            }
+            m_size = pairs.size();
+            pairs.clear();
+        }
+
+        /**
+          Makes room for keys and values below n.
+          */
+        void reserve(int n) {
+            if(n > 0) {
+                grow(m_left, quint32(n - 1));
+                grow(m_right, quint32(n - 1));
+            }
+        }
+
+        void swap(BiHash &other) {
+            qSwap(m_left, other.m_left);
+            qSwap(m_right, other.m_right);
+            qSwap(m_size, other.m_size);
+        }
+
+        int size() const {
+            return m_size;
+        }
+
+        bool isEmpty() const {
+            return m_size == 0;
+        }
+
+        void clear() {
+            m_left.clear();
+            m_right.clear();
+            m_size = 0;
+        }
+
+    protected:
+        static const quint32 NONE = 0xffffffff;     // unused key or value
+
+        /**
+          makes sure that a[i] exists, growing a geometrically
+          */
+        static void grow(QVector<quint32> &a, quint32 i) {
+            if(i < quint32(a.size()))
+                return;
+            const qint64 size = qMin(qMax(qint64(i) + 1, 2 * qint64(a.size())),
+                                     qint64(INT_MAX));
+            const int old = a.size();
+            a.resize(int(size));
+            qFill(a.begin() + old, a.end(), quint32(NONE));
+        }
+
+        QVector<quint32>    m_left;     // key -> value, NONE if unused
+        QVector<quint32>    m_right;    // value -> key, NONE if unused
+        int                 m_size;     // number of pairs
+    };
+
+    template <typename K, typename V>
+            QDebug operator<<(QDebug dbg, const BiHash<K,V> &hash) {
+        dbg.nospace() << "BiHash(";
+        for(typename BiHash<K,V>::const_iterator it = hash.constBegin();
+            it != hash.constEnd(); ++it)
+            dbg << '(' << it.key() << ", " << it.value() << ')';
+        dbg << ')';
+        return dbg.space();
+    }
 }
 
 
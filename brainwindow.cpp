@@ -26,26 +26,59 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "bfcompiler.h"
 #include "ui_brainwindow.h"
 #include "bfhighlighter.h"
+#include "bfsampler.h"
+#include "bfbracketmatcher.h"
+#include "bfcodeview.h"
+#include "bfmemorymodel.h"
 #include <QDebug>
 #include <QPalette>
 #include <QMessageBox>
 #include <QStandardItemModel>
 #include <QStandardItem>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QMap>
+#include <QLabel>
+#include <QTimer>
+#include <QRegExp>
+#include <QtAlgorithms>
+#include <climits>
 
 
 using namespace QtBrain;
 
+namespace {
+    /* table item that sorts by the number stored in Qt::UserRole instead of by its
+       text, so "10" doesn't end up before "9" */
+    class NumericItem : public QTableWidgetItem {
+    public:
+        NumericItem(const QString &text, double value) : QTableWidgetItem(text) {
+            setData(Qt::UserRole, value);
+            setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        }
+
+        bool operator<(const QTableWidgetItem &other) const {
+            return data(Qt::UserRole).toDouble() < other.data(Qt::UserRole).toDouble();
+        }
+    };
+}
+
 BrainWindow::BrainWindow(QWidget *parent) :
         QMainWindow(parent),
-        m_vm(new BfVM(this)),
+        m_vm(new BfVM()),     // lives in its own thread, so no parent
         m_compiler(new BfCompiler::BfCompiler(this)),
         m_jmps(NULL),
         m_mappings(NULL),
-        m_memMap(new Memtype[BfVM::MAX_MEM_ADDR+1]), /* +1 because MAX_MEM_ADDR only gives us
-                                                        the largest possible _address_, not
-                                                        the size of the memory */
+        m_sampler(new BfSampler(m_vm, this)),
+        m_outputLog(NULL),
+        m_compileTimer(new QTimer(this)),
+        m_speedTimer(new QTimer(this)),
+        m_lastRetired(0),
+        m_shownEpoch(0),
+        m_memoryModel(new BfMemoryModel(this)),
         m_vmNeedsInput(false),
+        m_inputSent(0),
+        m_inputFromFile(false),
         m_documentDirty(false),
         ui(new Ui::BrainWindow)
 
@@ -57,32 +90,31 @@ BrainWindow::BrainWindow(QWidget *parent) :
 
     connect(this, SIGNAL(compile(const QString&)), m_compiler,
             SLOT(compile(const QString&)));
+    connect(this, SIGNAL(compileFile(const QString&)), m_compiler,
+            SLOT(compileFile(const QString&)));
+    connect(this, SIGNAL(compileDocument(QTextDocument*)), m_compiler,
+            SLOT(compileDocument(QTextDocument*)));
+    connect(this, SIGNAL(prepareDocument(QTextDocument*)), m_compiler,
+            SLOT(prepareDocument(QTextDocument*)));
 
 
     connect(m_compiler, SIGNAL(compiled(QList<BfOpcode>,
                                         BiHash<IPType,IPType>&,
-                                        BiHash<IPType,quint32>&)),
+                                        BfSourceMap&)),
             this, SLOT(compiled(QList<BfOpcode>,
                                 BiHash<IPType,IPType>&,
-                                BiHash<IPType,quint32>&)));
+                                BfSourceMap&)));
 
 
     ui->setupUi(this);
 
 
 
-    clearMemMap();
     connectToVM();
     additionalUISetup();
     disableRunActions();
 }
 
-void BrainWindow::clearMemMap() {
-    for(int i = BfVM::MAX_MEM_ADDR+1; i --> 0;) {
-        m_memMap[i] = 0;
-    }
-}
-
 void BrainWindow::connectToVM() {
     /* connect a signal to the VM's public initialize() slots so the user can load new
        programs into the VM */
@@ -108,20 +140,35 @@ void BrainWindow::connectToVM() {
     connect(m_vm, SIGNAL(running(bool)), this, SLOT(vmRunning(bool)));
     connect(m_vm, SIGNAL(finish()), this, SLOT(vmFinished()));
     connect(m_vm, SIGNAL(needInput()), this, SLOT(vmNeedInput()));
-    /* remove characters from the input QLineEdit when the VM signals it has consumed
-       input */
-    connect(m_vm, SIGNAL(inputConsumed()), this, SLOT(vmConsumedInput()));
 
-    // receive IP information
-    connect(m_vm, SIGNAL(heartBeat(const IPType&)), this, SLOT(vmHeartBeat(const IPType&)));
+    // receive IP, DP, memory and input buffer changes in one go
+    connect(m_vm, SIGNAL(snapshot(const BfVMSnapshot&)), this,
+            SLOT(vmSnapshot(const BfVMSnapshot&)));
 
     // receive output from the VM
-    connect(m_vm, SIGNAL(output(const Memtype&)), this, SLOT(vmOutput(const Memtype&)));
 
-    connect(m_vm, SIGNAL(DPChanged(DPType)), this, SLOT(vmDPChanged(DPType)));
-    connect(m_vm, SIGNAL(memChanged(DPType,Memtype)), this,
-            SLOT(vmMemChanged(DPType,Memtype)));
     connect(m_vm, SIGNAL(breakpoint(IPType,DPType)),this,SLOT(vmBreakPoint(IPType,DPType)));
+    connect(this, SIGNAL(setBreakpoint(IPType,const BfBreakpoint&)), m_vm,
+            SLOT(setBreakpoint(IPType,const BfBreakpoint&)));
+    connect(this, SIGNAL(clearBreakpoint(IPType)), m_vm, SLOT(clearBreakpoint(IPType)));
+    connect(this, SIGNAL(addWatchpoint(DPType,DPType,const BfCondition&)), m_vm,
+            SLOT(addWatchpoint(DPType,DPType,const BfCondition&)));
+    connect(ui->actionClear_watchpoints, SIGNAL(triggered()), m_vm,
+            SLOT(clearWatchpoints()));
+    connect(m_vm, SIGNAL(watchpoint(IPType,DPType)), this,
+            SLOT(vmWatchpoint(IPType,DPType)));
+
+    connect(ui->actionProfile_loops, SIGNAL(toggled(bool)), m_vm,
+            SLOT(setLoopProfiling(bool)));
+    connect(m_vm, SIGNAL(loopProfile(const QList<LoopProfile>&)), this,
+            SLOT(vmLoopProfile(const QList<LoopProfile>&)));
+    connect(ui->actionProfile_memory, SIGNAL(toggled(bool)), m_vm,
+            SLOT(setMemoryProfiling(bool)));
+    connect(m_vm, SIGNAL(memoryProfile(const BfMemoryProfile&)), this,
+            SLOT(vmMemoryProfile(const BfMemoryProfile&)));
+
+    connect(ui->sbSampleRate, SIGNAL(valueChanged(int)), m_sampler,
+            SLOT(setFrequency(int)));
 
 
 }
@@ -151,37 +198,33 @@ void BrainWindow::additionalUISetup() {
     // start out in the IDE tab
     ui->viewsTab->setCurrentIndex(0);
 
+    /* the memory view shows the whole tape, straight from the VM's memory. The view only
+       asks the model for the rows it shows, so it doesn't matter how large the tape is */
+    m_memoryModel->setTape(m_vm->view()->cells(), m_vm->view()->size());
+    ui->tblMemory->setModel(m_memoryModel);
     /* The UI designer keeps removing my vertical header, so this kluge should force it
        to be visible */
     ui->tblMemory->verticalHeader()->setVisible(true);
+    ui->tblMemory->horizontalHeader()->setVisible(true);
+    ui->tblMemory->horizontalHeader()->setStretchLastSection(true);
 
-    /* memoize the header for DPs 0-4, since most BF programs spend most of their time
-       around there anyhow */
-    m_memStartHeader = new QStringList();
-    for(int i = 0; i <= 8; ++i) {
-        m_memStartHeader->append(tr("%1").arg(i));
-    }
-
-
-    /* allocates the QTableWidgetItems used in the memory table. When the table contents
-       change these items should be changed instead of creating new ones each time. */
-    QTableWidgetItem *twi;
-    for(int i = 0; i < 9; ++i) {
-        twi = new QTableWidgetItem(tr("0"));
-        twi->setTextAlignment(Qt::AlignHCenter);
-        ui->tblMemory->setItem(i,0, twi);
-    }
-
-
-    ui->tblMemory->setVerticalHeaderLabels(*m_memStartHeader);
-
-    resizeMemTable();
+    QAction *hex = ui->menuVM->addAction(trUtf8("Memory in &hex"));
+    hex->setCheckable(true);
+    connect(hex, SIGNAL(toggled(bool)), m_memoryModel, SLOT(setHexadecimal(bool)));
 
     // set m_debuggingMode to whatever state the QAction is in
     m_debuggingMode = ui->actionDebugging_mode->isChecked();
 
-    // the highlighter is only used in the IDE right now
-    m_highlighter = new BfHighlighter(ui->teIde->document());
+    // the highlighter is only used in the IDE right now. It belongs to the editor
+    m_highlighter = new BfHighlighter(ui->teIde);
+
+    /* bracket matching works from the compiled program. The background compile keeps
+       the IDE's up to date, the debugger's only changes when a program is loaded */
+    m_ideBrackets = new BfBracketMatcher(ui->teIde);
+    m_debugBrackets = new BfBracketMatcher(ui->teDebugProgram);
+    ui->teDebugProgram->setBracketMatcher(m_debugBrackets);
+    connect(m_compiler, SIGNAL(prepared(BiHash<IPType,IPType>,BfSourceMap)), m_ideBrackets,
+            SLOT(setProgram(BiHash<IPType,IPType>,BfSourceMap)));
 
 
     // store the original palette of the VM text input widget
@@ -198,6 +241,20 @@ void BrainWindow::additionalUISetup() {
 
     // notify the GUI if the document is edited
     connect(ui->teIde, SIGNAL(textChanged()), this, SLOT(setDocumentIsDirty()));
+
+    /* keep the compiler up to date while the user edits, so loading the program
+       doesn't have to compile much of anything */
+    m_compileTimer->setSingleShot(true);
+    m_compileTimer->setInterval(BACKGROUND_COMPILE_DELAY);
+    connect(ui->teIde, SIGNAL(textChanged()), m_compileTimer, SLOT(start()));
+    connect(m_compileTimer, SIGNAL(timeout()), this, SLOT(backgroundCompile()));
+
+    // live instructions/s readout
+    m_lbSpeed = new QLabel(this);
+    statusBar()->addPermanentWidget(m_lbSpeed);
+    connect(m_speedTimer, SIGNAL(timeout()), this, SLOT(updateSpeed()));
+    m_speedClock.start();
+    m_speedTimer->start(1000);
 }
 
 /*
@@ -212,11 +269,18 @@ void BrainWindow::disableRunActions(bool disa) {
 
 BrainWindow::~BrainWindow()
 {
+    // the sampler reads from the VM, so make sure it's not running when the VM goes
+    m_sampler->stopSampling();
+    closeOutputLog();
+    // the VM deletes its timer and state machine, so it has to be back in this thread
+    m_vm->quit();
+    m_vm->wait();
+    // the memory view reads the VM's memory, which is about to go
+    m_memoryModel->setTape(NULL, 0);
+    delete m_vm;
     delete ui;
     delete m_jmps;
     delete m_mappings;
-    delete m_memStartHeader;
-    delete m_memMap;
 }
 
 void BrainWindow::changeEvent(QEvent *e)
@@ -247,7 +311,7 @@ void BrainWindow::vmNeedInput() {
     }
 }
 
-void BrainWindow::compiled(const QList<BfOpcode> &src, BiHash<IPType, IPType> &jmps, BiHash<IPType, quint32> &mappings) {
+void BrainWindow::compiled(const QList<BfOpcode> &src, BiHash<IPType, IPType> &jmps, BfSourceMap &mappings) {
 
     programToDebugger();
 
@@ -259,11 +323,154 @@ void BrainWindow::compiled(const QList<BfOpcode> &src, BiHash<IPType, IPType> &j
     delete m_mappings;
 
     m_jmps = new BiHash<IPType,IPType>(jmps);
-    m_mappings = new BiHash<IPType,quint32>(mappings);
+    m_mappings = new BfSourceMap(mappings);
+
+    // a large file isn't in the editors, so there's nothing to match brackets in
+    if(m_largeFile.isEmpty()) {
+        m_ideBrackets->setProgram(jmps, mappings);
+        m_debugBrackets->setProgram(jmps, mappings);
+
+        m_sourceBreakpoints.clear();
+        for(int ip = 0; ip < src.size(); ++ip) {
+            if(src.at(ip) == BRK)
+                m_sourceBreakpoints.append(m_mappings->value(ip));
+        }
+
+        /* the breakpoints set in the debugger stay where they were in the source, as
+           long as there's still an instruction there. The VM forgot them when it got
+           the new program */
+        QMap<int, BfBreakpoint> kept;
+        QMap<int, BfBreakpoint>::const_iterator it;
+        for(it = m_breakpoints.constBegin(); it != m_breakpoints.constEnd(); ++it) {
+            const IPType ip = m_mappings->key(it.key());
+            if(m_mappings->containsKey(ip) && int(m_mappings->value(ip)) == it.key()
+                    && src.at(ip) != BRK) {
+                kept.insert(it.key(), it.value());
+                emit setBreakpoint(ip, it.value());
+            }
+        }
+        m_breakpoints = kept;
+    } else {
+        m_ideBrackets->clear();
+        m_debugBrackets->clear();
+        m_sourceBreakpoints.clear();
+        m_breakpoints.clear();
+    }
+    updateBreakpointMarkers();
     qDebug("BrainWindow::compiled()");
 }
 
 
+void BrainWindow::updateBreakpointMarkers() {
+    QList<int> all = m_sourceBreakpoints + m_breakpoints.keys();
+    qSort(all);
+    ui->teDebugProgram->setBreakpoints(all);
+}
+
+IPType BrainWindow::breakpointAtCursor(int *pos) const {
+    if(m_mappings == NULL || !m_largeFile.isEmpty())
+        return BfVM::NO_BREAKPOINT;
+
+    const IPType ip = m_mappings->key(ui->teDebugProgram->textCursor().position());
+    if(!m_mappings->containsKey(ip))
+        return BfVM::NO_BREAKPOINT;
+    *pos = m_mappings->value(ip);
+    if(qBinaryFind(m_sourceBreakpoints, *pos) != m_sourceBreakpoints.constEnd())
+        return BfVM::NO_BREAKPOINT; // a % always breaks
+    return ip;
+}
+
+void BrainWindow::on_actionToggle_breakpoint_triggered() {
+    int pos;
+    const IPType ip = breakpointAtCursor(&pos);
+    if(ip == BfVM::NO_BREAKPOINT)
+        return;
+
+    if(m_breakpoints.remove(pos) != 0) {
+        emit clearBreakpoint(ip);
+    } else {
+        m_breakpoints.insert(pos, BfBreakpoint());
+        emit setBreakpoint(ip, BfBreakpoint());
+    }
+    updateBreakpointMarkers();
+}
+
+void BrainWindow::on_actionConditional_breakpoint_triggered() {
+    int pos;
+    const IPType ip = breakpointAtCursor(&pos);
+    if(ip == BfVM::NO_BREAKPOINT)
+        return;
+    BfBreakpoint bp = m_breakpoints.value(pos);
+
+    bool ok;
+    const QString text = QInputDialog::getText(this, trUtf8("Conditional breakpoint"),
+                                               trUtf8("Stop when (e.g. *DP == 10 && "
+                                                      "mem[42] != 0, empty for always):"),
+                                               QLineEdit::Normal, bp.condition.text(),
+                                               &ok);
+    if(!ok)
+        return;
+    QString error;
+    bp.condition = BfCondition::parse(text, &error);
+    if(!bp.condition.isValid()) {
+        QMessageBox::warning(this, trUtf8("Conditional breakpoint"), error);
+        return;
+    }
+
+    const int hit = QInputDialog::getInt(this, trUtf8("Conditional breakpoint"),
+                                         trUtf8("Stop on hit number (0 stops on "
+                                                "every hit):"),
+                                         int(qMin(bp.hitCount, quint64(INT_MAX))),
+                                         0, INT_MAX, 1, &ok);
+    if(!ok)
+        return;
+    bp.hitCount = hit;
+
+    m_breakpoints.insert(pos, bp);
+    emit setBreakpoint(ip, bp);
+    updateBreakpointMarkers();
+}
+
+void BrainWindow::on_actionWatch_cells_triggered() {
+    bool ok;
+    const QString cells = QInputDialog::getText(this, trUtf8("Watch cells"),
+                                                trUtf8("Stop when any of these cells is "
+                                                       "written (e.g. 1234 or 100-110):"),
+                                                QLineEdit::Normal,
+                                                QString::number(m_memoryModel->dp()), &ok);
+    if(!ok)
+        return;
+
+    QRegExp range(QLatin1String("^\\s*(\\d{1,5})\\s*(?:-\\s*(\\d{1,5})\\s*)?$"));
+    int first = -1, last = -1;
+    if(range.exactMatch(cells)) {
+        first = range.cap(1).toInt();
+        last = range.cap(2).isEmpty() ? first : range.cap(2).toInt();
+    }
+    if(first < 0 || first > last || last > BfVM::MAX_MEM_ADDR) {
+        QMessageBox::warning(this, trUtf8("Watch cells"),
+                             trUtf8("\"%1\" isn't a cell or a range of cells between "
+                                    "0 and %2").arg(cells).arg(BfVM::MAX_MEM_ADDR));
+        return;
+    }
+
+    const QString text = QInputDialog::getText(this, trUtf8("Watch cells"),
+                                               trUtf8("Only stop when (e.g. *DP == 0, "
+                                                      "where *DP is the written cell. "
+                                                      "Empty for always):"),
+                                               QLineEdit::Normal, QString(), &ok);
+    if(!ok)
+        return;
+    QString error;
+    const BfCondition condition = BfCondition::parse(text, &error);
+    if(!condition.isValid()) {
+        QMessageBox::warning(this, trUtf8("Watch cells"), error);
+        return;
+    }
+
+    emit addWatchpoint(DPType(first), DPType(last), condition);
+}
+
 void BrainWindow::compilerError(const QString &msg, quint32 pos) {
     QMessageBox::critical(this, trUtf8("Compilation error"),
                           trUtf8("There was an error in the source somewhere near "
@@ -279,78 +486,190 @@ void BrainWindow::programToDebugger() {
     ui->teDebugProgram->setPlainText(ui->teIde->toPlainText());
 }
 
-void BrainWindow::vmOutput(const Memtype &data) {
-    //ui->teOutput->append(QChar::fromAscii(data));
-    ui->teOutput->insertPlainText(QChar::fromAscii(data));
+void BrainWindow::drainOutput() {
+    m_outputBuffer.append(m_vm->outputChannel()->readAll());
+    flushOutput();
+}
+
+void BrainWindow::flushOutput() {
+    if(m_outputBuffer.isEmpty())
+        return;
+    qDebug("BrainWindow::flushOutput() %d bytes", m_outputBuffer.size());
+
+    // the log gets everything...
+    if(m_outputLog != NULL)
+        m_outputLog->write(m_outputBuffer);
+
+    /* ...but the output pane only keeps its scrollback anyway, so there's no point in
+       laying out megabytes of text just to throw it away */
+    if(m_outputBuffer.size() > MAX_OUTPUT_CHUNK)
+        m_outputBuffer = m_outputBuffer.right(MAX_OUTPUT_CHUNK);
+
+    QTextCursor tc(ui->teOutput->document());
+    tc.movePosition(QTextCursor::End);
+    tc.insertText(QString::fromLatin1(m_outputBuffer.constData(), m_outputBuffer.size()));
     ui->teOutput->moveCursor(QTextCursor::End);
-    qDebug("vmOutput();");
 
+    m_outputBuffer.clear();
 }
 
-void BrainWindow::vmConsumedInput() {
-    qDebug("BrainWindow::vmConsumedInput()");
-    QString orig = ui->leInput->text();
-    QString consumed;
-    if(orig.size() == 1) {
-        consumed = QString();
-    } else {
-        // "pop" one character
-        consumed = orig.right(orig.size()-1);
+void BrainWindow::on_actionOutput_scrollback_triggered() {
+    bool ok;
+    const int lines = QInputDialog::getInt(this, trUtf8("Output scrollback"),
+                                           trUtf8("Lines of output to keep "
+                                                  "(0 keeps everything):"),
+                                           ui->teOutput->maximumBlockCount(),
+                                           0, 10000000, 1000, &ok);
+    if(ok)
+        ui->teOutput->setMaximumBlockCount(lines);
+}
+
+void BrainWindow::on_actionLog_output_toggled(bool checked) {
+    closeOutputLog();
+    if(!checked)
+        return;
+
+    const QString fileName = QFileDialog::getSaveFileName(this,
+                                                          trUtf8("Log output to..."));
+    if(!fileName.isEmpty()) {
+        m_outputLog = new QFile(fileName, this);
+        if(m_outputLog->open(QIODevice::WriteOnly)) {
+            statusBar()->showMessage(trUtf8("Logging output to %1").arg(fileName), 3000);
+            return;
+        }
+        QMessageBox::warning(this, trUtf8("QtBrain"),
+                             trUtf8("Error writing to file %1:\n%2").arg(fileName)
+                             .arg(m_outputLog->errorString()));
+        closeOutputLog();
     }
 
-    ui->leInput->setText(consumed);
+    // no log after all
+    ui->actionLog_output->blockSignals(true);
+    ui->actionLog_output->setChecked(false);
+    ui->actionLog_output->blockSignals(false);
 }
 
-void BrainWindow::vmDPChanged(DPType dp) {
-    // TODO: CHANGE MEMORY TABLE!
-    if(m_debuggingMode) {
-        /* FIXME: QLineEdit::setText() is hideously slow and calling it repeatedly will make X11
-           beg for mercy */
-        ui->leDP->setText(tr("%1").arg(dp));
-        changeMemView(dp);
+void BrainWindow::on_actionInput_from_file_toggled(bool checked) {
+    if(!checked) {
+        m_vm->setInputDevice(NULL);
+        m_inputFromFile = false;
+        ui->leInput->setEnabled(!ui->actionRun->isChecked());
+        return;
     }
+
+    const QString fileName = QFileDialog::getOpenFileName(this,
+                                                          trUtf8("Read input from..."));
+    if(!fileName.isEmpty()) {
+        // the VM takes the file over, so no parent
+        QFile *file = new QFile(fileName);
+        if(file->open(QIODevice::ReadOnly)) {
+            m_vm->setInputDevice(file);
+            m_inputFromFile = true;
+            ui->leInput->setDisabled(true);
+            statusBar()->showMessage(trUtf8("Reading input from %1").arg(fileName), 3000);
+            return;
+        }
+        QMessageBox::warning(this, trUtf8("QtBrain"),
+                             trUtf8("Error reading file %1:\n%2").arg(fileName)
+                             .arg(file->errorString()));
+        delete file;
+    }
+
+    // no input file after all
+    ui->actionInput_from_file->blockSignals(true);
+    ui->actionInput_from_file->setChecked(false);
+    ui->actionInput_from_file->blockSignals(false);
 }
 
-/* shows 4 cells of memory to the left and right of the DP, so total number of cells
-   shown is 9 (4 cells + the cell the DP is on + 4 cells). If DP is less than 4, it just
-   shows cells 0 - 9, and if the DP wanders near BfVM::MAX_MEM_ADDR-4 it just shows
-   everything up to the largest address */
-void BrainWindow::changeMemView(DPType dp) {
-    ui->tblMemory->setVerticalHeaderLabels(makeHeaderForPos(dp));
-    int min, selected = 4;
-    if(dp <= 4) {
-        min = 0;
-        selected = dp;
-    } else if(dp > 4 && dp < BfVM::MAX_MEM_ADDR-4) {
-        min = dp-4;
-    } else {
-        min = BfVM::MAX_MEM_ADDR - 8;
+void BrainWindow::on_actionOutput_to_file_toggled(bool checked) {
+    if(!checked) {
+        m_vm->setOutputDevice(NULL);
+        return;
     }
 
-    for(int i = 0; i <= 8; ++i) {
-        ui->tblMemory->item(i,0)->setText(tr("%1").arg(m_memMap[min+i]));
+    const QString fileName = QFileDialog::getSaveFileName(this,
+                                                          trUtf8("Write output to..."));
+    if(!fileName.isEmpty()) {
+        // the VM takes the file over, so no parent
+        QFile *file = new QFile(fileName);
+        if(file->open(QIODevice::WriteOnly)) {
+            m_vm->setOutputDevice(file);
+            statusBar()->showMessage(trUtf8("Writing output to %1").arg(fileName), 3000);
+            return;
+        }
+        QMessageBox::warning(this, trUtf8("QtBrain"),
+                             trUtf8("Error writing to file %1:\n%2").arg(fileName)
+                             .arg(file->errorString()));
+        delete file;
     }
 
-    resizeMemTable();
-    ui->tblMemory->selectRow(selected);
+    // no output file after all
+    ui->actionOutput_to_file->blockSignals(true);
+    ui->actionOutput_to_file->setChecked(false);
+    ui->actionOutput_to_file->blockSignals(false);
+}
 
+void BrainWindow::closeOutputLog() {
+    if(m_outputLog == NULL)
+        return;
+    // whatever is still buffered belongs in the log too
+    flushOutput();
+    delete m_outputLog; // closes the file
+    m_outputLog = NULL;
 }
 
-void BrainWindow::vmMemChanged(DPType dp, Memtype mt) {
-    m_memMap[dp] = mt;
-    int dpPos = 4;
-    if(m_debuggingMode) {
-        if(dp <= 4) {
-            dpPos = dp;
-        } else if (dp > BfVM::MAX_MEM_ADDR-4) {
-            dpPos = 4+(dp - (BfVM::MAX_MEM_ADDR-4));
-        }
-        ui->tblMemory->item(dpPos,0)->setText(tr("%1").arg(mt));
-        resizeMemTable();
+void BrainWindow::consumeInput(quint32 count) {
+    qDebug("BrainWindow::consumeInput() %u", count);
+    // input read from a file has nothing to do with leInput
+    if(m_inputFromFile)
+        return;
+    // "pop" the consumed characters
+    ui->leInput->setText(ui->leInput->text().mid(count));
+    m_inputSent = qMax(0, m_inputSent - int(count));
+}
+
+void BrainWindow::vmSnapshot(const BfVMSnapshot &snap) {
+    /* the VM writes its output straight to the output channel, and a snapshot is the
+       hint that there may be something there */
+    drainOutput();
+
+    // the memory view fetches the written rows from the VM again if they're visible
+    if(snap.isDirty())
+        m_memoryModel->cellsChanged(snap.dirtyStart, snap.dirtyEnd);
+
+    if(snap.inputConsumed > 0)
+        consumeInput(snap.inputConsumed);
+
+    if(!m_debuggingMode)
+        return;
+
+    /* the registers are read from the VM when we get here, not when the snapshot was
+       sent. If several snapshots queued up, the first one shows the latest registers
+       and the rest have nothing new to show */
+    IPType ip;
+    DPType dp;
+    const quint32 epoch = m_vm->view()->registers(&ip, &dp);
+    if(epoch == m_shownEpoch)
+        return;
+    m_shownEpoch = epoch;
+
+    /* QLineEdit::setText() is hideously slow, but snapshots come in at most
+       BfVM::SNAPSHOT_FPS times a second so X11 shouldn't have to beg for mercy anymore */
+    ui->leIP->setText(QString::number(ip));
+    ui->leDP->setText(QString::number(dp));
+    m_memoryModel->setDp(dp);
+    ui->tblMemory->scrollTo(m_memoryModel->indexOf(dp));
+
+    /* the IP is past the last instruction when the program ends, and a large file
+       isn't in the debugger view at all */
+    if(m_mappings != NULL && m_mappings->containsKey(ip) && m_largeFile.isEmpty()) {
+        // paints the IP at the corresponding position in the source
+        ui->teDebugProgram->setIp(m_mappings->value(ip));
     }
 }
 
 
+
 /**
   The VM sends the reset and clear signals when it enters the clear state, so
   clearing doesn't have to explicitly do the same things as reset
@@ -366,22 +685,29 @@ void BrainWindow::vmReset() {
 
     ui->leDP->setText(tr("0"));
     ui->leIP->setText(tr("0"));
+    // the VM threw away its input buffer
     ui->leInput->setText(QString());
+    m_inputSent = 0;
 
-    if(m_debuggingMode) {
-        // reset the debugger program view cursor too
-        moveDbgCursor(ui->teDebugProgram, 0, true);
-    }
+    // the debugger program view shows no IP until the first step
+    ui->teDebugProgram->setIp(-1);
 
-    // clears the "local copy" of the VM's memory we're keeping around
-    clearMemMap();
-    // clears the memory view in the GUI.
-    clearMemoryTbl();
+    // a new run gets a new profile
+    m_sampler->clear();
+    ui->tblSamples->setRowCount(0);
+    ui->lbHotCells->clear();
+    m_memoryModel->clearProfile();
+    ui->lbMemoryProfile->clear();
+
+    // the VM has cleared its memory by now
+    m_memoryModel->allCellsChanged();
+    m_memoryModel->setDp(0);
 
 }
 
 void BrainWindow::vmFinished() {
     qDebug() << "VM finished";
+    drainOutput();
     // Ensure all actions are in the right state
     ui->actionRun->setDisabled(true);
     ui->actionStep->setDisabled(true);
@@ -390,33 +716,160 @@ void BrainWindow::vmFinished() {
     ui->actionReset->setEnabled(true);
 }
 
-void BrainWindow::vmHeartBeat(const IPType &ip) {
-    qDebug("VM heartbeat, IP %d",ip);
+void BrainWindow::vmBreakPoint(IPType ip, DPType dp) {
+    qDebug("BrainWindow::vmBreakPoint() IP %u DP %u", ip, dp);
+    /* the VM publishes a snapshot when it stops at the breakpoint, and debugging mode
+       makes sure we show it */
+    ui->actionDebugging_mode->setChecked(true);
+}
 
-    if(m_debuggingMode) {
+void BrainWindow::vmWatchpoint(IPType ip, DPType dp) {
+    qDebug("BrainWindow::vmWatchpoint() IP %u DP %u", ip, dp);
+    // the IP has moved past the instruction by the time the VM stops
+    const QString where = m_mappings != NULL && m_mappings->containsKey(ip)
+                          ? trUtf8("position %1").arg(m_mappings->value(ip))
+                          : trUtf8("instruction %1").arg(ip);
+    statusBar()->showMessage(trUtf8("Cell %1 was written at %2").arg(dp).arg(where));
+    ui->actionDebugging_mode->setChecked(true);
+}
 
-        /* FIXME: QLineEdit::setText() is hideously slow and calling it repeatedly will make X11
-       beg for mercy */
-        ui->leIP->setText(QString::number((unsigned int)ip));
-        /* should I replace call to m_mappings->value with an array lookup? The array
-       would be the same length as the _compiled_ program itself, and contain the mapped
-       values in it. So looking up m_mapArry[i] would look up the mapping for the command
-       at IP position i. This would, of course, mean that I'd be trading off processing time
-       for memory usage, and a program of maximum allowed size (2^32 instructions) would
-       cause the GUI to eat up a whopping 16 gigaBYTES of memory. On the other hand, how
-       likely are we to see a Brainfuck program with 137 438 953 472 commands in it? */
+void BrainWindow::vmMemoryProfile(const BfMemoryProfile &profile) {
+    qDebug("BrainWindow::vmMemoryProfile() DP %d-%d", profile.minDp, profile.maxDp);
+    m_memoryModel->setProfile(profile);
+    if(profile.isEmpty()) {
+        ui->lbMemoryProfile->clear();
+        return;
+    }
 
-        const quint32 srcPos = m_mappings->value(ip);
-        // moves the cursor to the corresponding position in the source
-        moveDbgCursor(ui->teDebugProgram, srcPos);
+    QStringList hot;
+    foreach(DPType cell, profile.hottest(8)) {
+        hot << tr("%1 (%2r/%3w)").arg(cell).arg(profile.reads[cell])
+               .arg(profile.writes[cell]);
     }
+    ui->lbMemoryProfile->setText(tr("Tape used: cells %1-%2 (%3 cells, %4 touched). "
+                                    "Most accessed: %5")
+                                 .arg(profile.minDp).arg(profile.maxDp)
+                                 .arg(profile.span()).arg(profile.cellsTouched())
+                                 .arg(hot.join(", ")));
 }
 
-void BrainWindow::vmBreakPoint(IPType ip, DPType dp) {
-    qDebug("BrainWindow::vmBreakPoint();");
-    ui->actionDebugging_mode->setChecked(true);
-    vmHeartBeat(ip);
-    vmDPChanged(dp);
+void BrainWindow::vmLoopProfile(const QList<LoopProfile> &profile) {
+    qDebug("BrainWindow::vmLoopProfile() %d loops", profile.size());
+    QTableWidget *tbl = ui->tblLoopProfile;
+
+    // don't let the table re-sort itself after every item
+    tbl->setSortingEnabled(false);
+    tbl->setRowCount(profile.size());
+
+    int row = 0;
+    foreach(const LoopProfile &lp, profile) {
+        const quint32 srcPos = m_mappings ? m_mappings->value(lp.jz) : lp.jz;
+        const double avgTrip = lp.entries ? double(lp.iterations) / lp.entries : 0.0;
+
+        QTableWidgetItem *pos = new NumericItem(QString::number(srcPos), srcPos);
+        // remember the loop's IPs so it can be found in the source later
+        pos->setData(Qt::UserRole+1, lp.jz);
+        pos->setData(Qt::UserRole+2, lp.jnz);
+
+        tbl->setItem(row, 0, pos);
+        tbl->setItem(row, 1, new NumericItem(QString::number(lp.entries), lp.entries));
+        tbl->setItem(row, 2, new NumericItem(QString::number(lp.iterations),
+                                             lp.iterations));
+        tbl->setItem(row, 3, new NumericItem(QString::number(avgTrip, 'f', 1), avgTrip));
+        tbl->setItem(row, 4, new NumericItem(QString::number(lp.maxIterations),
+                                             lp.maxIterations));
+        tbl->setItem(row, 5, new NumericItem(QString::number(lp.instructions),
+                                             lp.instructions));
+        ++row;
+    }
+
+    tbl->setSortingEnabled(true);
+    tbl->resizeColumnsToContents();
+}
+
+void BrainWindow::on_tblLoopProfile_cellDoubleClicked(int row, int) {
+    if(m_mappings == NULL)
+        return;
+
+    const QTableWidgetItem *pos = ui->tblLoopProfile->item(row, 0);
+    const IPType jz = pos->data(Qt::UserRole+1).toUInt();
+    const IPType jnz = pos->data(Qt::UserRole+2).toUInt();
+
+    // select the whole loop, from the [ to the ]
+    QTextCursor tc = ui->teIde->textCursor();
+    tc.setPosition(m_mappings->value(jz));
+    tc.setPosition(m_mappings->value(jnz)+1, QTextCursor::KeepAnchor);
+    ui->teIde->setTextCursor(tc);
+
+    ui->viewsTab->setCurrentWidget(ui->ideTab);
+    ui->teIde->setFocus();
+}
+
+void BrainWindow::showSamples() {
+    QTableWidget *tbl = ui->tblSamples;
+    const QHash<IPType, quint32> ipSamples = m_sampler->ipSamples();
+    const double total = m_sampler->sampleCount();
+
+    tbl->setSortingEnabled(false);
+    tbl->setRowCount(ipSamples.size());
+
+    int row = 0;
+    QHash<IPType, quint32>::const_iterator it;
+    for(it = ipSamples.constBegin(); it != ipSamples.constEnd(); ++it, ++row) {
+        // the IP is one past the program when it has finished
+        const quint32 srcPos = m_mappings && m_mappings->containsKey(it.key())
+                               ? m_mappings->value(it.key()) : it.key();
+        const double percent = 100.0 * it.value() / total;
+
+        tbl->setItem(row, 0, new NumericItem(QString::number(srcPos), srcPos));
+        tbl->setItem(row, 1, new NumericItem(QString::number(it.key()), it.key()));
+        tbl->setItem(row, 2, new NumericItem(QString::number(it.value()), it.value()));
+        tbl->setItem(row, 3, new NumericItem(QString::number(percent, 'f', 2), percent));
+    }
+
+    tbl->setSortingEnabled(true);
+    tbl->sortItems(2, Qt::DescendingOrder);
+    tbl->resizeColumnsToContents();
+
+    // the few cells the DP spent the most time on
+    QMultiMap<quint32, DPType> byCount;
+    const QHash<DPType, quint32> dpSamples = m_sampler->dpSamples();
+    QHash<DPType, quint32>::const_iterator dit;
+    for(dit = dpSamples.constBegin(); dit != dpSamples.constEnd(); ++dit) {
+        byCount.insert(dit.value(), dit.key());
+    }
+
+    QStringList hot;
+    QMapIterator<quint32, DPType> mit(byCount);
+    mit.toBack();
+    while(mit.hasPrevious() && hot.size() < 8) {
+        mit.previous();
+        hot << tr("%1 (%2%)").arg(mit.value()).arg(100.0 * mit.key() / total, 0, 'f', 1);
+    }
+    ui->lbHotCells->setText(hot.isEmpty() ? QString()
+                                          : tr("Hottest cells: %1").arg(hot.join(", ")));
+}
+
+void BrainWindow::on_tblSamples_cellDoubleClicked(int row, int) {
+    const quint32 srcPos = ui->tblSamples->item(row, 0)->data(Qt::UserRole).toUInt();
+
+    QTextCursor tc = ui->teIde->textCursor();
+    tc.setPosition(srcPos);
+    tc.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
+    ui->teIde->setTextCursor(tc);
+
+    ui->viewsTab->setCurrentWidget(ui->ideTab);
+    ui->teIde->setFocus();
+}
+
+void BrainWindow::on_actionSample_profile_toggled(bool checked) {
+    // the VM might already be running, in which case it won't tell us again
+    if(checked && ui->actionRun->isChecked()) {
+        m_sampler->startSampling();
+    } else if(!checked) {
+        m_sampler->stopSampling();
+        showSamples();
+    }
 }
 
 void BrainWindow::closeEvent(QCloseEvent *e) {
@@ -429,27 +882,25 @@ void BrainWindow::closeEvent(QCloseEvent *e) {
 
 void BrainWindow::on_actionLoad_program_triggered()
 {
-    emit compile(ui->teIde->toPlainText());
+    if(!m_largeFile.isEmpty())
+        emit compileFile(m_largeFile);
+    else
+        emit compileDocument(ui->teIde->document());
 }
 
-void BrainWindow::sendOutput() {
-    qDebug("BrainWindow::sendOutput()");
-    emit output(ui->leInput->text());
+void BrainWindow::backgroundCompile() {
+    // the editor only has a notice in it
+    if(!m_largeFile.isEmpty())
+        return;
+    emit prepareDocument(ui->teIde->document());
 }
 
-void BrainWindow::moveDbgCursor(QPlainTextEdit* te, const quint32 dir, bool reset) {
-    QTextCursor tc = te->textCursor();
-
-    // reset cursor position or move it to an absolute position
-    if(reset) {
-        tc.setPosition(0);
-    } else {
-        tc.setPosition(dir);
-        /* moves the cursor forwards but keeps the anchor in place. Now the
-           first character should be selected */
-        tc.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-    }
-    te->setTextCursor(tc);
+void BrainWindow::sendOutput() {
+    qDebug("BrainWindow::sendOutput()");
+    // the VM appends what it's given, so only send what it doesn't have yet
+    const QString text = ui->leInput->text();
+    emit output(text.mid(m_inputSent));
+    m_inputSent = text.size();
 }
 
 
@@ -457,41 +908,23 @@ void BrainWindow::vmRunning(bool running) {
     qDebug() << "vmRunning()" << running;
     ui->actionRun->setChecked(running);
     /* disable the ability to change the text input buffer while the VM is running */
-    ui->leInput->setDisabled(running);
-
-}
-
-void BrainWindow::clearMemoryTbl() {
-    ui->tblMemory->setVerticalHeaderLabels(makeHeaderForPos(0));
-    for(int i = 0; i < 9; ++i) {
-        ui->tblMemory->item(0,i)->setText(tr("0"));
+    ui->leInput->setDisabled(running || m_inputFromFile);
+
+    // only sample while the VM is actually running, an idle IP would skew the profile
+    if(ui->actionSample_profile->isChecked()) {
+        if(running) {
+            m_sampler->startSampling();
+        } else {
+            m_sampler->stopSampling();
+            showSamples();
+        }
     }
-    resizeMemTable();
-}
 
+}
 
 
-QStringList BrainWindow::makeHeaderForPos(DPType dp) {
-    QStringList result;
-    DPType min, max;
 
 
-    /* the DP is always at the center of the table, at position 4 */
-
-    if(dp<=4) {
-        return *m_memStartHeader;
-    } else if(dp > 4 && dp < BfVM::MAX_MEM_ADDR-4) {
-        min = dp-4;
-    } else { // the last 9 elements
-        max = BfVM::MAX_MEM_ADDR;
-        min = max - 8;
-    }
-
-    for(int i = min; i <= min+8; ++i) {
-        result << tr("%1").arg(i);
-    }
-    return result;
-}
 
 void BrainWindow::setCurrentDocument(const QString &text) {
 
@@ -503,12 +936,6 @@ void BrainWindow::setCurrentDocument(const QString &text) {
     m_documentDirty = false;
 }
 
-inline void BrainWindow::resizeMemTable() {
-    //ui->tblMemory->resizeColumnsToContents(); // FIXME: not doing anything. Why?
-    //ui->tblMemory->resizeRowsToContents();
-    ui->tblMemory->horizontalHeader()->setStretchLastSection(true);
-    ui->tblMemory->verticalHeader()->setStretchLastSection(true);
-}
 
 
 void BrainWindow::setDocumentIsDirty() {
@@ -529,6 +956,20 @@ void BrainWindow::setDocumentIsDirty() {
 
 
 
+void BrainWindow::updateSpeed() {
+    const quint64 retired = m_vm->metrics().instructions;
+    const int elapsed = m_speedClock.restart();
+
+    // the counters start over from 0 when the VM is reset
+    const quint64 delta = retired >= m_lastRetired ? retired - m_lastRetired : retired;
+    m_lastRetired = retired;
+
+    if(elapsed > 0) {
+        m_lbSpeed->setText(tr("%1 instructions/s").arg(qRound64(delta * 1000.0 / elapsed)));
+    }
+}
+
+
 bool BrainWindow::saveAs() {
     QString fileName = QFileDialog::getSaveFileName(this,
                                                     trUtf8("Save Brainfuck source as..."));
@@ -537,6 +978,20 @@ bool BrainWindow::saveAs() {
 
     qDebug() << "on_actionSaveAs_triggered() filename" <<fileName;
 
+    // the editor only has a notice, the source is still in the file
+    if(!m_largeFile.isEmpty()) {
+        QFile::remove(fileName);
+        if(!QFile::copy(m_largeFile, fileName)) {
+            QMessageBox::warning(this, trUtf8("QtBrain"),
+                                 trUtf8("Error writing to file %1").arg(fileName));
+            return false;
+        }
+        m_largeFile = fileName;
+        setCurrentDocument(fileName);
+        statusBar()->showMessage(trUtf8("File saved"), 3000);
+        return true;
+    }
+
     return writeToFile(ui->teIde->toPlainText(), fileName);
 
 }
@@ -559,6 +1014,9 @@ bool BrainWindow::maybeSave() {
 
 
 bool BrainWindow::save() {
+    // a large file can't be edited, so there's never anything to save
+    if(!m_largeFile.isEmpty())
+        return true;
     if(m_documentName.isEmpty())
         return saveAs();
     else
@@ -600,6 +1058,13 @@ void BrainWindow::open() {
                                      .arg(fileName).arg(file.errorString()));
                 return;
             }
+            // the editor would choke on huge files, so those are compiled from the file
+            if(file.size() > MAX_EDITOR_FILE_SIZE) {
+                openLargeFile(fileName, file.size());
+                return;
+            }
+            closeLargeFile();
+
             QTextStream in(&file);
 #ifndef QT_NO_CURSOR
             QApplication::setOverrideCursor(Qt::WaitCursor);
@@ -618,6 +1083,23 @@ void BrainWindow::open() {
 
 
 
+void BrainWindow::openLargeFile(const QString &fileName, qint64 size) {
+    m_largeFile = fileName;
+    ui->teIde->setReadOnly(true);
+    ui->teIde->setPlainText(trUtf8("%1 is too large to edit here (%2 MB).\n"
+                                   "It will be compiled straight from the file.")
+                            .arg(fileName).arg(size >> 20));
+    setCurrentDocument(fileName);
+    statusBar()->showMessage(trUtf8("File opened without editing"), 3000);
+}
+
+void BrainWindow::closeLargeFile() {
+    if(m_largeFile.isEmpty())
+        return;
+    m_largeFile.clear();
+    ui->teIde->setReadOnly(false);
+}
+
 void BrainWindow::on_actionOpen_triggered()
 {
     open();
@@ -637,6 +1119,7 @@ void BrainWindow::on_actionSaveAs_triggered()
 void BrainWindow::on_actionNew_triggered()
 {
     if(maybeSave()) {
+        closeLargeFile();
         ui->teIde->clear();
         setCurrentDocument(QString());
         ui->actionLoad_program->setEnabled(false);
@@ -651,7 +1134,6 @@ void BrainWindow::on_actionDebugging_mode_toggled(bool checked)
     ui->leIP->setEnabled(checked);
     ui->tblMemory->setEnabled(checked);
     if(!checked) { // if debugging mode is not on, hide the "IP cursor" in the debugger
-        clearMemoryTbl();
-        ui->teDebugProgram->moveCursor(QTextCursor::Start);
+        ui->teDebugProgram->setIp(-1);
     }
 }
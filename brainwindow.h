@@ -26,12 +26,18 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "bfvm.h"
 #include "bihash.h"
+#include "bfsourcemap.h"
 #include <QMainWindow>
 #include <QFile>
+#include <QTime>
+#include <QMap>
 
 namespace QtBrain {
     class BfCompiler;
     class BfHighlighter;
+    class BfSampler;
+    class BfBracketMatcher;
+    class BfMemoryModel;
 }
 
 namespace Ui {
@@ -42,6 +48,9 @@ using namespace QtBrain;
 
 class QPlainTextEdit;
 class QStandardItemModel;
+class QTextDocument;
+class QLabel;
+class QTimer;
 
 
 class BrainWindow : public QMainWindow {
@@ -63,6 +72,14 @@ signals:
     void output(const QString&); // to send data to the VM
 
     void compile(const QString&); // to send data to the compiler
+    void compileFile(const QString&); // to have the compiler read a file by itself
+    void compileDocument(QTextDocument*);   // to compile the editor's contents
+    void prepareDocument(QTextDocument*);   // to compile them in the background
+
+    void setBreakpoint(IPType, const BfBreakpoint&);// sent to the VM
+    void clearBreakpoint(IPType);
+    void addWatchpoint(DPType, DPType, const BfCondition&);
+    void clearWatchpoints();
 
 
     ///////////////////////////////////////////////////////////////////////////////////////
@@ -76,16 +93,10 @@ protected slots:
     void vmFinished();      // used to receive the finish() signal from the VM
     void vmRunning(bool);   // is the VM running or not?
     void vmNeedInput();     // VM needs input
-    void vmHeartBeat(const IPType&); // used to receive the heartbeat() signal from the VM
-    void vmConsumedInput();   /* used to receive the inputConsumed() signal from the VM */
-
-    void vmDPChanged(DPType); // used to receive DP change signals from the VM
 
-    /* when a cell of memory is changed, this method caches the contents and then shows the
-       change in the table. */
-    void vmMemChanged(DPType,Memtype);
-
-    void vmOutput(const Memtype&);
+    /* applies a snapshot of the VM's state: caches the changed memory contents, removes
+       consumed input and shows the IP, DP and memory in the debugger in one go. */
+    void vmSnapshot(const BfVMSnapshot&);
 
     void sendOutput();      /* when the user presses enter in the Input field,
                                the QLineEdit emits a signal. This signal is sent to
@@ -95,6 +106,11 @@ protected slots:
     void programToDebugger();/* loads the source from the IDE tab to the debugger tab */
 
     void vmBreakPoint(IPType, DPType);
+    void vmWatchpoint(IPType, DPType);  // tells where the watched cell was written
+
+    void vmLoopProfile(const QList<LoopProfile>&); /* fills the loop profile table */
+    void vmMemoryProfile(const BfMemoryProfile&);  /* shows the heatmap in the memory
+                                                      view and sums it up */
 
 
 
@@ -105,7 +121,7 @@ protected slots:
 
     // data from the compiler. Look in bfcompiler.h for more information
     void compiled(const QList<BfOpcode>&, BiHash<IPType,IPType> &jmps,
-                  BiHash<IPType,quint32> &mappings);
+                  BfSourceMap &mappings);
 
 
 
@@ -126,24 +142,41 @@ private:
     BfCompiler                      *m_compiler;   // the QThread for the compiler
     BiHash<IPType,IPType>           *m_jmps;       // brace matching hash
 
-    /* should I replace call to m_mappings->value with an array lookup? The array
-       would be the same length as the _compiled_ program itself, and contain the mapped
-       values in it. So looking up m_mapArry[i] would look up the mapping for the command
-       at IP position i. This would, of course, mean that I'd be trading off processing time
-       for memory usage, and a program of maximum allowed size (2^32 instructions) would
-       cause the GUI to eat up a whopping 16 gigaBYTES of memory. On the other hand, how
-       likely are we to see a Brainfuck program with 137 438 953 472 commands in it? */
-    BiHash<IPType,quint32>          *m_mappings;   // bytecode <-> source position mappings
+    BfSourceMap                     *m_mappings;   /* bytecode <-> source position mappings.
+                                                      An array lookup, so cheap enough for
+                                                      every snapshot */
     BfHighlighter                   *m_highlighter;// syntax highlighter
-    Memtype                         *m_memMap;     // just a duplicate of the VM's memory...
+    BfBracketMatcher                *m_ideBrackets;/* bracket matching and loop folding */
+    BfBracketMatcher                *m_debugBrackets;// in teIde and teDebugProgram
+    BfSampler                       *m_sampler;    // the sampling profiler
+
+    QByteArray                      m_outputBuffer;/* VM output waiting to be appended
+                                                      to the output pane */
+    QFile                           *m_outputLog;  /* if not NULL, all output is also
+                                                      written here */
+
+    QTimer                          *m_compileTimer;/* compiles the editor's contents
+                                                      in the background once the user
+                                                      stops typing for a moment */
+
+    QLabel                          *m_lbSpeed;    // instructions/s in the status bar
+    QTimer                          *m_speedTimer; // updates m_lbSpeed once a second
+    QTime                           m_speedClock;  // time since the last update
+    quint64                         m_lastRetired; /* VM instruction count at the last
+                                                      update */
+    quint32                         m_shownEpoch;  /* the epoch of the VM registers
+                                                      shown in debugging mode */
+    BfMemoryModel                   *m_memoryModel;// shows the VM's memory in tblMemory
 
     QPalette                        m_inputOriginalPalette;
     QPalette                        m_attentionPalette;
 
-    QStringList                     *m_memStartHeader;// the table header for DPs 0-4
-
     bool                            m_vmNeedsInput;/* set to true when the vm needs input.
                                                       Dirty hack... */
+    int                             m_inputSent;   /* how many characters at the start of
+                                                      leInput have been sent to the VM */
+    bool                            m_inputFromFile;/* true if the VM reads its input from
+                                                      a file instead of leInput */
 
     bool                            m_debuggingMode;// if true, enable debugging mode
 
@@ -152,6 +185,13 @@ private:
 
     QString                         m_documentName;/* the name of the document being
                                                       edited */
+    QString                         m_largeFile;   /* if not empty, the open file was too
+                                                      large for the editor and is compiled
+                                                      straight from here */
+
+    QMap<int, BfBreakpoint>         m_breakpoints; /* the breakpoints set in the
+                                                      debugger, by source position */
+    QList<int>                      m_sourceBreakpoints;/* and of the %s in the source */
 
     Ui::BrainWindow *ui;
 
@@ -162,36 +202,37 @@ private:
     //// PRIVATE METHODS
     ////////////////////
 
-    // Zeroes the memory table contents and header
-    void clearMemoryTbl();
-
     void resetUi();                          // resets memory state, DP, IP etc widgets
     void disableRunActions(bool wot = true); // disables and enables VM-related actions
     void additionalUISetup();// connects local QActions to state change signals in the VM etc
     void connectToVM(); // connects local slots to VM state information signals
     void connectToCompiler(); // connects local slots to compiler information signals
 
-    void clearMemMap(); // zeroes the memory map
+    void updateBreakpointMarkers(); // shows all breakpoints in the debugger view
 
-    // creates the proper header for the memory table
-    QStringList makeHeaderForPos(DPType dp);
+    /* the IP of the instruction at or after the debugger's cursor, where a breakpoint
+       would go, and its source position. NO_BREAKPOINT if there's none or it's a % */
+    IPType breakpointAtCursor(int *pos) const;
 
-    // when the DP moves, this function changes the Table to reflect the change.
-    void changeMemView(DPType);
 
+    // reads everything the VM has written to its output channel and shows it
+    void drainOutput();
 
-    /* Moves the "cursor" in the debugging view of the program.
+    static const int MAX_OUTPUT_CHUNK = 1 << 20;/* at most this many bytes are
+                                                   appended to the output pane at once */
+    static const qint64 MAX_EDITOR_FILE_SIZE = 8 << 20;/* larger files aren't loaded into
+                                                          the editor */
+    static const int BACKGROUND_COMPILE_DELAY = 500;/* ms without edits before compiling
+                                                       in the background */
 
-       If reset is true, the cursor is "reset", ie. nothing is selected.
+    // closes the output log file, if any
+    void closeOutputLog();
 
-       This _SHOULD_ probably be done by subclassing QTextEdit and then making a
-       custom caret for it by painting on the widget, but this'll do for
-       now.
-    */
-    void moveDbgCursor(QPlainTextEdit* te, const quint32 dir=0, bool reset=false);
+    // removes count characters the VM has read from the input QLineEdit
+    void consumeInput(quint32 count);
 
-    // makes the memory table the right size
-    void resizeMemTable();
+    // fills the sampled hot spots table with what the sampling profiler found
+    void showSamples();
 
     // changes the current document
     void setCurrentDocument(const QString &);
@@ -206,6 +247,11 @@ private:
     bool saveFile(const QString &fileName);
     void open();
 
+    // shows a file that's too large to edit, see m_largeFile
+    void openLargeFile(const QString &fileName, qint64 size);
+    // back to editing normally
+    void closeLargeFile();
+
     /////////////////////////////////////////////////////////////////////////////////////////
     //// PRIVATE SLOTS
     //////////////////
@@ -225,9 +271,35 @@ private slots:
     void on_slTickDelay_valueChanged(int value);
     void on_actionLoad_program_triggered();
 
+    // shows the double-clicked loop in the IDE
+    void on_tblLoopProfile_cellDoubleClicked(int row, int column);
+    void on_tblSamples_cellDoubleClicked(int row, int column);
+
+    void on_actionSample_profile_toggled(bool checked);
+
+    // sets or clears a breakpoint on the instruction at the debugger's cursor
+    void on_actionToggle_breakpoint_triggered();
+    // asks for a condition and hit count for the breakpoint there
+    void on_actionConditional_breakpoint_triggered();
+    // asks for the cells to watch and a condition
+    void on_actionWatch_cells_triggered();
+
     // sets whether the document needs saving or not. Default to true
     void setDocumentIsDirty();
 
+    // polls the VM's metrics and shows how many instructions/s it's running
+    void updateSpeed();
+
+    void backgroundCompile();   // brings the compiler up to date with the editor
+
+    // appends the buffered VM output to the output pane
+    void flushOutput();
+
+    void on_actionOutput_scrollback_triggered();
+    void on_actionLog_output_toggled(bool checked);
+    void on_actionInput_from_file_toggled(bool checked);
+    void on_actionOutput_to_file_toggled(bool checked);
+
 };
 
 #endif // BRAINWINDOW_H
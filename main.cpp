@@ -22,11 +22,70 @@ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVE
 ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include <QtGui/QApplication>
+#include <QTimer>
+#include <QTextStream>
+#include <QHash>
 #include "brainwindow.h"
+#include "bfrunner.h"
 
 
+/* Runs a program without the GUI. Usage:
+   QtBrain -run program.bf [-metrics metrics.json] [-memprofile memory.json]
+                           [-input file] [-eof mode] [-nocache]
+
+   Input is read from stdin if no input file (or "-") is given. The EOF mode says what
+   the program's , does at the end of input: "unchanged" (the default), "zero",
+   "minus1", or "wait", which makes the runner give up. -nocache always compiles the
+   program instead of using the copy compiled the last time. -memprofile counts the
+   reads and writes of every cell and writes the DP range and the hottest cells */
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    BfRunner runner;
+
+    QStringList args = a.arguments();
+    QHash<QString, BfEofBehaviour> eofModes;
+    eofModes.insert(QLatin1String("unchanged"), EOF_UNCHANGED);
+    eofModes.insert(QLatin1String("zero"), EOF_ZERO);
+    eofModes.insert(QLatin1String("minus1"), EOF_MINUS_ONE);
+    eofModes.insert(QLatin1String("wait"), EOF_WAIT);
+    for(int i = 1; i < args.size(); ++i) {
+        if(args[i] == QLatin1String("-run") && i+1 < args.size()) {
+            runner.setSourceFile(args[++i]);
+        } else if(args[i] == QLatin1String("-metrics") && i+1 < args.size()) {
+            runner.setMetricsFile(args[++i]);
+        } else if(args[i] == QLatin1String("-memprofile") && i+1 < args.size()) {
+            runner.setMemoryProfileFile(args[++i]);
+        } else if(args[i] == QLatin1String("-input") && i+1 < args.size()) {
+            runner.setInputFile(args[++i]);
+        } else if(args[i] == QLatin1String("-eof") && i+1 < args.size()
+                  && eofModes.contains(args[i+1])) {
+            runner.setEofBehaviour(eofModes.value(args[++i]));
+        } else if(args[i] == QLatin1String("-nocache")) {
+            runner.setCacheEnabled(false);
+        } else {
+            QTextStream(stderr) << QCoreApplication::tr("Usage: %1 -run program.bf "
+                                                        "[-metrics metrics.json] "
+                                                        "[-memprofile memory.json] "
+                                                        "[-input file] "
+                                                        "[-eof unchanged|zero|minus1|wait] "
+                                                        "[-nocache]\n")
+                                   .arg(args[0]);
+            return 1;
+        }
+    }
+
+    QTimer::singleShot(0, &runner, SLOT(start()));
+    return a.exec();
+}
+
 int main(int argc, char *argv[])
 {
+    for(int i = 1; i < argc; ++i) {
+        if(qstrcmp(argv[i], "-run") == 0)
+            return runHeadless(argc, argv);
+    }
+
     QApplication a(argc, argv);
     BrainWindow w;
     a.setApplicationName(QApplication::trUtf8("QtBrain"));